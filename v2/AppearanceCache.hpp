@@ -0,0 +1,205 @@
+#ifndef APPEARANCECACHE_HPP
+#define APPEARANCECACHE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+#include "FrameSync.hpp"
+
+// compact appearance of one person: colour histogram of face and torso plus the
+// height of the top of the face, taken from the depth frame
+struct AppearanceSignature
+{
+	static const int bins = 64;
+
+	float histogram[bins]{};
+	float height{ 0 }; // mm above the optical axis of the depth camera
+	bool hasHeight{ false }; // false when the depth lookup hit a hole
+	bool valid{ false };
+
+	// histogram distance (0 same, 1 disjoint) plus 1 per 'heightScale' mm of height difference
+	float distance(const AppearanceSignature& other, float heightScale) const
+	{
+		float overlap = 0;
+		for (int i = 0; i < bins; i++)
+			overlap += std::sqrt(histogram[i] * other.histogram[i]);
+		float d = 1.f - overlap;
+		if (hasHeight && other.hasHeight)
+			d += std::fabs(height - other.height) / heightScale;
+		return d;
+	}
+
+	// slow blend so a single bad frame does not replace the signature
+	void blend(const AppearanceSignature& other, float weight)
+	{
+		if (!valid)
+		{
+			*this = other;
+			return;
+		}
+		for (int i = 0; i < bins; i++)
+			histogram[i] += (other.histogram[i] - histogram[i]) * weight;
+		if (other.hasHeight)
+		{
+			height = hasHeight ? height + (other.height - height) * weight : other.height;
+			hasHeight = true;
+		}
+	}
+};
+
+
+// astra depth camera vertical field of view, for turning depth rows into millimetres
+const double depthVerticalFov = 49.5;
+
+// signature of the face 'r' (colour pixels) and the torso below it
+// colour frames give a 4x4x4 BGR histogram, grey-only (headless) frames a 64 level one
+inline AppearanceSignature compute_signature(const cv::Mat& colour, const cv::Mat& luma, double lumaScale,
+	const DepthSlot& depth, const cv::Rect& r)
+{
+	AppearanceSignature signature;
+
+	// face plus a torso box of twice its width and height underneath
+	const cv::Rect torso(r.x - r.width / 2, r.y + r.height, r.width * 2, r.height * 2);
+	const cv::Rect boxes[2] = { r, torso };
+
+	int count = 0;
+	for (int b = 0; b < 2; b++)
+	{
+		if (!colour.empty())
+		{
+			const cv::Rect box = boxes[b] & cv::Rect(0, 0, colour.cols, colour.rows);
+			for (int y = box.y; y < box.y + box.height; y++)
+			{
+				const uchar* row = colour.ptr<uchar>(y) + box.x * 3;
+				for (int x = 0; x < box.width; x++)
+				{
+					signature.histogram[(row[3 * x] >> 6) * 16 + (row[3 * x + 1] >> 6) * 4 + (row[3 * x + 2] >> 6)]++;
+				}
+				count += box.width;
+			}
+		}
+		else
+		{
+			const cv::Rect scaled(cvRound(boxes[b].x * lumaScale), cvRound(boxes[b].y * lumaScale),
+				cvRound(boxes[b].width * lumaScale), cvRound(boxes[b].height * lumaScale));
+			const cv::Rect box = scaled & cv::Rect(0, 0, luma.cols, luma.rows);
+			for (int y = box.y; y < box.y + box.height; y++)
+			{
+				const uchar* row = luma.ptr<uchar>(y) + box.x;
+				for (int x = 0; x < box.width; x++)
+				{
+					signature.histogram[row[x] >> 2]++;
+				}
+				count += box.width;
+			}
+		}
+	}
+	if (count == 0)
+		return signature;
+
+	for (int i = 0; i < AppearanceSignature::bins; i++)
+		signature.histogram[i] /= count;
+
+	// top of the face in the depth frame (4x smaller), lifted to mm with the pinhole model
+	const int z = depth.at((r.x + r.width / 2) / 4, r.y / 4 + 1);
+	const double focal = (depth.height / 2) / std::tan(depthVerticalFov * CV_PI / 360.0);
+	signature.height = (float)((depth.height / 2 - r.y / 4) * z / focal);
+	signature.hasHeight = z > 0;
+	signature.valid = true;
+	return signature;
+}
+
+
+// recently lost tracks, so a person turning away for a while is not counted and
+// verified again when they come back. bounded: the least recently lost entry is
+// evicted first, and entries expire after 'timeout' seconds
+class AppearanceCache
+{
+public:
+	void configure(int capacity, double timeout, float threshold)
+	{
+		entries_.assign(capacity, Entry());
+		timeout_ = timeout;
+		threshold_ = threshold;
+	}
+
+	// the same without forgetting anybody
+	void set_limits(double timeout, float threshold)
+	{
+		timeout_ = timeout;
+		threshold_ = threshold;
+	}
+
+	void insert(const AppearanceSignature& signature, double now)
+	{
+		if (entries_.empty() || !signature.valid)
+			return;
+
+		// a free slot, else the oldest one
+		int slot = 0;
+		for (int i = 0; i < entries_.size(); i++)
+		{
+			if (!entries_[i].used)
+			{
+				slot = i;
+				break;
+			}
+			if (entries_[i].lost < entries_[slot].lost)
+				slot = i;
+		}
+		entries_[slot].signature = signature;
+		entries_[slot].lost = now;
+		entries_[slot].used = true;
+	}
+
+	// the closest lost track within the threshold is taken out of the cache
+	bool match(const AppearanceSignature& signature, double now)
+	{
+		if (!signature.valid)
+			return false;
+
+		int best = -1;
+		float bestDistance = threshold_;
+		for (int i = 0; i < entries_.size(); i++)
+		{
+			if (!entries_[i].used)
+				continue;
+			if (now - entries_[i].lost > timeout_)
+			{
+				entries_[i].used = false;
+				continue;
+			}
+			const float d = entries_[i].signature.distance(signature, heightScale);
+			if (d < bestDistance)
+			{
+				bestDistance = d;
+				best = i;
+			}
+		}
+
+		if (best < 0)
+			return false;
+		entries_[best].used = false;
+		hits_++;
+		return true;
+	}
+
+	long long hits() const { return hits_; }
+
+	static constexpr float heightScale = 200.f; // mm of height difference worth a whole histogram
+
+private:
+	struct Entry
+	{
+		AppearanceSignature signature;
+		double lost{ 0 };
+		bool used{ false };
+	};
+
+	std::vector<Entry> entries_;
+	double timeout_{ 30 };
+	float threshold_{ 0.35f };
+	long long hits_{ 0 };
+};
+
+#endif // APPEARANCECACHE_HPP
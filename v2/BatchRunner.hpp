@@ -0,0 +1,173 @@
+#ifndef BATCHRUNNER_HPP
+#define BATCHRUNNER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define batch_popen _popen
+#define batch_pclose _pclose
+#else
+#define batch_popen popen
+#define batch_pclose pclose
+#endif
+
+// runs one child process per recording, 'jobs' at a time
+// the pipeline keeps its state in globals, so recordings are processed in parallel as
+// separate processes rather than threads. every child is this program with
+// --batch-one <recording>; it reports on stdout with lines the runner picks out:
+//   @progress <frames> <bytes read>
+//   @result <frames> <recorded seconds> <people counted> <processing seconds>
+// everything else it prints goes to <recording>.log
+class BatchRunner
+{
+public:
+	BatchRunner(const std::string& program, const std::vector<std::string>& recordings)
+		: program_(program), jobs_(recordings.size())
+	{
+		for (int i = 0; i < jobs_.size(); i++)
+		{
+			jobs_[i].path = recordings[i];
+			std::ifstream file(recordings[i], std::ios::binary | std::ios::ate);
+			jobs_[i].bytes = file ? (long long)file.tellg() : 0;
+			totalBytes_ += jobs_[i].bytes;
+		}
+	}
+
+	// blocks until every recording is done, with a progress line once a second
+	void run(int parallel)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> workers;
+		for (int w = 0; w < parallel && w < jobs_.size(); w++)
+			workers.push_back(std::thread(&BatchRunner::work, this));
+
+		double reported = 0;
+		while (finished_ < jobs_.size())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (elapsed - reported >= 1)
+			{
+				print_progress(elapsed);
+				reported = elapsed;
+			}
+		}
+		for (int w = 0; w < workers.size(); w++)
+			workers[w].join();
+		seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// per-session results as csv, and a summary on the console
+	bool write_report(const std::string& path) const
+	{
+		std::ofstream out(path);
+		out << "recording,frames,recorded_s,counted,processing_s,fps,status\n";
+		long long frames = 0;
+		for (int i = 0; i < jobs_.size(); i++)
+		{
+			const Job& job = jobs_[i];
+			out << job.path << "," << job.resultFrames << "," << job.recorded << "," << job.counted << ","
+				<< job.processing << "," << (job.processing > 0 ? job.resultFrames / job.processing : 0) << ","
+				<< (job.ok ? "ok" : "failed") << "\n";
+			std::cout << "  " << job.path << ": " << (job.ok ? "" : "FAILED, ") << job.counted << " counted, "
+				<< job.resultFrames << " frames, " << job.recorded << " s recorded" << std::endl;
+			frames += job.resultFrames;
+		}
+		std::cout << "Batch: " << jobs_.size() << " recordings, " << frames << " frames in " << seconds_ << " s, "
+			<< (seconds_ > 0 ? frames / seconds_ : 0) << " fps overall, report in " << path << std::endl;
+		return (bool)out;
+	}
+
+private:
+	struct Job
+	{
+		std::string path;
+		long long bytes{ 0 };
+		std::atomic<long long> frames{ 0 };
+		std::atomic<long long> done{ 0 }; // bytes
+		// set by the worker before 'finished_' is counted up
+		long long resultFrames{ 0 };
+		double recorded{ 0 };
+		int counted{ 0 };
+		double processing{ 0 };
+		bool ok{ false };
+	};
+
+	void work()
+	{
+		while (true)
+		{
+			const int i = next_++;
+			if (i >= jobs_.size())
+				return;
+			Job& job = jobs_[i];
+
+			std::string command = "\"" + program_ + "\" --batch-one \"" + job.path + "\"";
+#ifdef _WIN32
+			// cmd /c drops the outer quotes of the whole line
+			command = "\"" + command + "\"";
+#endif
+			FILE* pipe = batch_popen(command.c_str(), "r");
+			if (pipe)
+			{
+				std::ofstream log(job.path + ".log");
+				char line[1024];
+				long long frames, bytes;
+				bool result = false;
+				while (std::fgets(line, sizeof(line), pipe))
+				{
+					if (std::sscanf(line, "@progress %lld %lld", &frames, &bytes) == 2)
+					{
+						job.frames = frames;
+						job.done = bytes;
+					}
+					else if (std::sscanf(line, "@result %lld %lf %d %lf", &job.resultFrames, &job.recorded, &job.counted, &job.processing) == 4)
+					{
+						result = true;
+					}
+					else
+					{
+						log << line;
+					}
+				}
+				job.ok = batch_pclose(pipe) == 0 && result;
+			}
+			job.frames = job.resultFrames;
+			job.done = job.bytes;
+			finished_++;
+		}
+	}
+
+	void print_progress(double elapsed) const
+	{
+		long long frames = 0;
+		long long done = 0;
+		for (int i = 0; i < jobs_.size(); i++)
+		{
+			frames += jobs_[i].frames;
+			done += jobs_[i].done;
+		}
+		const std::streamsize precision = std::cout.precision();
+		std::cout << "Batch: " << finished_ << "/" << jobs_.size() << " recordings, "
+			<< std::fixed << std::setprecision(1) << (totalBytes_ > 0 ? 100.0 * done / totalBytes_ : 0) << "%, "
+			<< frames << " frames, " << (elapsed > 0 ? frames / elapsed : 0) << " fps, "
+			<< (elapsed > 0 ? done / elapsed / (1 << 20) : 0) << " MB/s" << std::defaultfloat << std::setprecision(precision) << std::endl;
+	}
+
+	std::string program_;
+	std::vector<Job> jobs_;
+	long long totalBytes_{ 0 };
+	std::atomic<int> next_{ 0 };
+	std::atomic<int> finished_{ 0 };
+	double seconds_{ 0 };
+};
+
+#endif // BATCHRUNNER_HPP
@@ -0,0 +1,158 @@
+#ifndef CONFIGWATCHER_HPP
+#define CONFIGWATCHER_HPP
+
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// watches the settings file and hands every new version that parses to the pipeline
+// on linux inotify reports writes and renames in the file's directory (editors often
+// save by renaming a new file over the old one); elsewhere the modification time is
+// polled. a new version is parsed on the watcher thread and published as an immutable
+// snapshot with an atomic pointer swap; the pipeline take()s it between frames, so a
+// frame never sees half of one version and half of another
+class ConfigWatcher
+{
+public:
+	typedef std::shared_ptr<const nlohmann::json> Snapshot;
+
+	~ConfigWatcher() { stop(); }
+
+	void start(const std::string& path)
+	{
+		if (thread_.joinable())
+			return;
+
+		path_ = path;
+		const size_t slash = path.find_last_of("/\\");
+		directory_ = slash == std::string::npos ? "." : path.substr(0, slash);
+		file_ = slash == std::string::npos ? path : path.substr(slash + 1);
+		last_ = read_file();
+		running_ = true;
+		thread_ = std::thread(&ConfigWatcher::run, this);
+	}
+
+	void stop()
+	{
+		running_ = false;
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+	// the newest version since the last call, or nothing
+	Snapshot take()
+	{
+		if (!std::atomic_load(&pending_))
+			return Snapshot();
+		return std::atomic_exchange(&pending_, Snapshot());
+	}
+
+private:
+	void run()
+	{
+#ifdef __linux__
+		const int fd = inotify_init1(IN_NONBLOCK);
+		const int watch = fd >= 0 ? inotify_add_watch(fd, directory_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) : -1;
+		if (watch >= 0)
+		{
+			alignas(inotify_event) char events[4096];
+			while (running_)
+			{
+				pollfd p = { fd, POLLIN, 0 };
+				if (poll(&p, 1, 500) <= 0)
+					continue;
+
+				bool ours = false;
+				ssize_t length;
+				while ((length = read(fd, events, sizeof(events))) > 0)
+				{
+					for (char* e = events; e < events + length; e += sizeof(inotify_event) + ((inotify_event*)e)->len)
+					{
+						const inotify_event* event = (const inotify_event*)e;
+						ours = ours || (event->len > 0 && file_ == event->name);
+					}
+				}
+				if (ours)
+					changed();
+			}
+			close(fd);
+			return;
+		}
+		if (fd >= 0)
+			close(fd);
+#endif
+		// no inotify: the modification time, twice a second
+		time_t modified = modification_time();
+		while (running_)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+			const time_t now = modification_time();
+			if (now != modified)
+			{
+				modified = now;
+				changed();
+			}
+		}
+	}
+
+	void changed()
+	{
+		// whoever is writing it gets a moment to finish
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		const std::string text = read_file();
+		if (text.empty() || text == last_)
+			return;
+		last_ = text;
+
+		Snapshot snapshot;
+		try
+		{
+			snapshot = std::make_shared<const nlohmann::json>(nlohmann::json::parse(text));
+		}
+		catch (const nlohmann::json::exception& e)
+		{
+			std::cout << "Settings: " << path_ << " does not parse, keeping the current settings (" << e.what() << ")" << std::endl;
+			return;
+		}
+		std::atomic_store(&pending_, snapshot);
+	}
+
+	std::string read_file() const
+	{
+		std::ifstream in(path_);
+		std::ostringstream text;
+		text << in.rdbuf();
+		return text.str();
+	}
+
+	time_t modification_time() const
+	{
+		struct stat st;
+		return stat(path_.c_str(), &st) == 0 ? st.st_mtime : 0;
+	}
+
+	std::string path_;
+	std::string directory_;
+	std::string file_;
+	std::string last_; // text of the version published last
+
+	Snapshot pending_;
+	std::atomic<bool> running_{ false };
+	std::thread thread_;
+};
+
+#endif // CONFIGWATCHER_HPP
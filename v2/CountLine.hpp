@@ -0,0 +1,193 @@
+#ifndef COUNTLINE_HPP
+#define COUNTLINE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// recent positions of one track plus the side of every count line it was last seen on
+struct TrackPath
+{
+	static const int historySize = 8;
+	static const int maxLines = 8;
+
+	cv::Point points[historySize];
+	int head{ 0 };
+	int count{ 0 };
+	signed char side[maxLines]{}; // -1 / +1, 0 until it has been clearly on one side
+
+	void push(const cv::Point& p)
+	{
+		head = (head + 1) % historySize;
+		points[head] = p;
+		if (count < historySize)
+			count++;
+	}
+
+	// 0 is the latest position, count - 1 the oldest kept
+	const cv::Point& at(int back) const
+	{
+		return points[(head - back + historySize) % historySize];
+	}
+};
+
+
+// in/out crossings of one line during one minute
+struct FlowMinute
+{
+	long long minute{ -1 };
+	int in{ 0 };
+	int out{ 0 };
+};
+
+
+// a virtual count line between two points (colour pixels)
+// crossing it from the left of from->to to the right is "in", the other way "out"
+struct CountLine
+{
+	static const int minutes = 60; // per-minute buckets kept
+
+	std::string name;
+	cv::Point from;
+	cv::Point to;
+	int hysteresis{ 10 }; // px either side of the line that do not change the side
+
+	long long in{ 0 };
+	long long out{ 0 };
+	FlowMinute buckets[minutes];
+
+	// signed distance of a point, positive on the right of from->to (image y points down)
+	double distance(const cv::Point& p) const
+	{
+		const double dx = to.x - from.x;
+		const double dy = to.y - from.y;
+		const double length = std::sqrt(dx * dx + dy * dy);
+		if (length == 0)
+			return 0;
+		return (dx * (p.y - from.y) - dy * (p.x - from.x)) / length;
+	}
+
+	int side(const cv::Point& p) const
+	{
+		const double d = distance(p);
+		return d > hysteresis ? 1 : d < -hysteresis ? -1 : 0;
+	}
+
+	FlowMinute& bucket(long long minute)
+	{
+		FlowMinute& b = buckets[minute % minutes];
+		if (b.minute != minute)
+		{
+			b.minute = minute;
+			b.in = 0;
+			b.out = 0;
+		}
+		return b;
+	}
+};
+
+
+// directional counting on a set of lines
+// a track changes side only once it is more than the hysteresis away from the line, so
+// jitter around the line is not counted; the move then counts when the segment from its
+// last position on the old side to the new one passes between the line's end points
+class CountLines
+{
+public:
+	bool add_line(const CountLine& line)
+	{
+		if (lines_.size() >= TrackPath::maxLines || line.from == line.to)
+			return false;
+		lines_.push_back(line);
+		return true;
+	}
+
+	bool empty() const { return lines_.empty(); }
+
+	// a new position of a track, 'now' in seconds
+	void update(TrackPath& path, const cv::Point& p, double now)
+	{
+		path.push(p);
+		for (int l = 0; l < lines_.size(); l++)
+		{
+			CountLine& line = lines_[l];
+			const int s = line.side(p);
+			if (s == 0 || s == path.side[l])
+				continue;
+			if (path.side[l] == 0)
+			{
+				path.side[l] = s;
+				continue;
+			}
+
+			// last kept position still clearly on the old side, else the oldest one
+			cv::Point previous = path.at(path.count - 1);
+			for (int k = 1; k < path.count; k++)
+			{
+				if (line.side(path.at(k)) == path.side[l])
+				{
+					previous = path.at(k);
+					break;
+				}
+			}
+			path.side[l] = s;
+
+			// changed side past the end of the line
+			if (!crosses(line, previous, p))
+				continue;
+
+			FlowMinute& b = line.bucket((long long)(now / 60));
+			if (s > 0)
+			{
+				line.in++;
+				b.in++;
+			}
+			else
+			{
+				line.out++;
+				b.out++;
+			}
+		}
+	}
+
+	// totals since start, plus the per-minute figures each time a minute has completed
+	void print(double now)
+	{
+		const long long minute = (long long)(now / 60);
+		const bool minuteDone = lastMinute_ >= 0 && minute > lastMinute_;
+		for (int l = 0; l < lines_.size(); l++)
+		{
+			const CountLine& line = lines_[l];
+			std::cout << "Line " << line.name << ": in " << line.in << ", out " << line.out << std::endl;
+			if (minuteDone)
+			{
+				const FlowMinute& b = line.buckets[lastMinute_ % CountLine::minutes];
+				const int in = b.minute == lastMinute_ ? b.in : 0;
+				const int out = b.minute == lastMinute_ ? b.out : 0;
+				char clock[8];
+				std::snprintf(clock, sizeof(clock), "%02d:%02d", (int)(lastMinute_ / 60 % 24), (int)(lastMinute_ % 60));
+				std::cout << "Line " << line.name << " " << clock << ": in " << in << "/min, out " << out << "/min" << std::endl;
+			}
+		}
+		lastMinute_ = minute;
+	}
+
+private:
+	// the move p->q ends on the other side, so it only has to pass between the end points
+	static bool crosses(const CountLine& line, const cv::Point& p, const cv::Point& q)
+	{
+		const double dx = q.x - p.x;
+		const double dy = q.y - p.y;
+		const double a = dx * (line.from.y - p.y) - dy * (line.from.x - p.x);
+		const double b = dx * (line.to.y - p.y) - dy * (line.to.x - p.x);
+		return (a <= 0 && b >= 0) || (a >= 0 && b <= 0);
+	}
+
+	std::vector<CountLine> lines_;
+	long long lastMinute_{ -1 };
+};
+
+#endif // COUNTLINE_HPP
@@ -0,0 +1,453 @@
+#ifndef COUNTINGCORE_HPP
+#define COUNTINGCORE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TrackFilter.hpp"
+#include "WorldTrack.hpp"
+
+// the people counting state machines of v1 and v2, without detection or display
+// both take one frame of detections at a time (colour px, with the distance of every
+// face in mm) and keep their own count, so they can be run side by side over the same
+// sequence. ids() says which of their tracks each detection of the last frame went to
+class Counter
+{
+public:
+	virtual ~Counter() {}
+
+	virtual std::string name() const = 0;
+
+	// one frame; 'now' in seconds
+	virtual void update(const std::vector<cv::Rect>& faces, const std::vector<int>& distances, double now) = 0;
+
+	virtual int count() const = 0;
+
+	// track id of every detection of the last update, -1 when it is not in a track
+	const std::vector<int>& ids() const { return ids_; }
+
+protected:
+	std::vector<int> ids_;
+};
+
+
+// v1: a face is the same person as the first known face of about the same size; it
+// is counted once it has been seen for 'timerTrigger' seconds without a break
+class V1Counter : public Counter
+{
+public:
+	V1Counter(int minDist, int maxDist, int timerTrigger)
+		: minDist_(minDist), maxDist_(maxDist), timerTrigger_(timerTrigger)
+	{}
+
+	std::string name() const override { return "v1"; }
+
+	void update(const std::vector<cv::Rect>& faces, const std::vector<int>& distances, double now) override
+	{
+		ids_.assign(faces.size(), -1);
+
+		// first run through
+		if (objects_.empty())
+		{
+			for (int i = 0; i < faces.size(); i++)
+			{
+				if (distances[i] > minDist_ && distances[i] < maxDist_)
+				{
+					ids_[i] = (int)objects_.size();
+					objects_.push_back(Object{ faces[i], now, false, false });
+				}
+			}
+			return;
+		}
+
+		for (int x = 0; x < objects_.size(); x++)
+			objects_[x].detected = false;
+
+		for (int i = 0; i < faces.size(); i++)
+		{
+			if (!(distances[i] > minDist_ && distances[i] < maxDist_))
+				continue;
+
+			const cv::Rect& r = faces[i];
+			bool matched = false;
+			for (int x = 0; x < objects_.size(); x++)
+			{
+				// similar size
+				if (std::abs(objects_[x].box.height - r.height) < 75 && std::abs(objects_[x].box.width - r.width) < 75)
+				{
+					matched = true;
+					objects_[x].box = r;
+					objects_[x].detected = true;
+					ids_[i] = x;
+					if (now - objects_[x].saved > timerTrigger_ && !objects_[x].triggered)
+					{
+						count_++;
+						objects_[x].triggered = true;
+					}
+					break;
+				}
+			}
+			if (!matched)
+			{
+				ids_[i] = (int)objects_.size();
+				objects_.push_back(Object{ r, now, false, false });
+			}
+		}
+
+		// not seen this frame - the timer starts again
+		for (int x = 0; x < objects_.size(); x++)
+		{
+			if (!objects_[x].detected)
+			{
+				objects_[x].saved = now;
+				objects_[x].triggered = false;
+			}
+		}
+	}
+
+	int count() const override { return count_; }
+
+private:
+	struct Object
+	{
+		cv::Rect box;
+		double saved;
+		bool detected;
+		bool triggered;
+	};
+
+	int minDist_;
+	int maxDist_;
+	int timerTrigger_;
+	std::vector<Object> objects_;
+	int count_{ 0 };
+};
+
+
+// what the live pipeline does around the v2 state machine - appearance, snapshots,
+// zones, count lines, events. the harness runs without any. 'track' is an index into
+// tracking(), 'face' one into the detections of the update
+class CountingHooks
+{
+public:
+	virtual ~CountingHooks() {}
+
+	// a new face in range, neither verifying nor tracked: true when it is someone lost a
+	// short while ago, who goes straight back to tracking and is not counted again
+	virtual bool reidentify(int face) { return false; }
+
+	// 'track' was just added at the back of tracking(), verified or re-identified
+	virtual void added(int track, int face, bool reidentified) {}
+
+	// 'track' took 'face'; its box and times are still those of the frame before
+	virtual void matched(int track, int face) {}
+
+	// 'track' is lost for good and about to be erased
+	virtual void lost(int track) {}
+};
+
+
+// v2: a new face in range is verified for 2 s, then tracked; a tracked face is counted
+// when it has been lost for 2 s. optionally with the constant-velocity prediction of
+// TrackFilter.hpp ("kalman") and with matching in world space ("worldTracking"). this
+// is the association detectAndDraw runs, the harness runs the very same code
+class V2Counter : public Counter
+{
+public:
+	struct Track
+	{
+		cv::Rect box;
+		double start; // s
+		double lastSeen; // s
+		int id;
+		bool counted; // re-identified, already counted when it was first lost
+		WorldPoint world; // mm, z 0 when not known
+		double worldTime; // s, when 'world' was measured
+	};
+
+	V2Counter() {}
+
+	V2Counter(int minDist, int maxDist, bool kalman, float processNoise, float measurementNoise)
+	{
+		set_range(minDist, maxDist);
+		set_kalman(kalman, processNoise, measurementNoise, 1000.f, 50.f, std::numeric_limits<int>::max());
+	}
+
+	// new faces are only verified between these distances (mm)
+	void set_range(int minDist, int maxDist)
+	{
+		minDist_ = minDist;
+		maxDist_ = maxDist;
+	}
+
+	// prediction on or off, its noise, and how far (mm) a detection may be off the
+	// predicted distance of a tracked face
+	void set_kalman(bool kalman, float processNoise, float measurementNoise, float depthProcessNoise, float depthMeasurementNoise, int depthGate)
+	{
+		kalman_ = kalman;
+		depthGate_ = depthGate;
+		filters_.configure(processNoise, measurementNoise, depthProcessNoise, depthMeasurementNoise);
+	}
+
+	// match in the room wherever both positions are known
+	void set_world(bool world, const WorldReach& reach)
+	{
+		world_ = world;
+		reach_ = reach;
+	}
+
+	// no reallocation below this many faces
+	void reserve(int faces)
+	{
+		verifying_.reserve(faces);
+		tracking_.reserve(faces);
+		taken_.reserve(faces);
+		remove_.reserve(faces);
+		ids_.reserve(faces);
+		filters_.reserve(faces);
+	}
+
+	std::string name() const override { return kalman_ ? "v2+kalman" : "v2"; }
+
+	// the timers run on whole seconds, as they always did live
+	void update(const std::vector<cv::Rect>& faces, const std::vector<int>& distances, double now) override
+	{
+		update(faces, distances, (const WorldPoint*)nullptr, now, std::floor(now), nullptr);
+	}
+
+	// one frame: 'world' the room position of every detection (z 0 when not known) or
+	// null, 'now' the capture time in seconds, 'seconds' the timer clock (whole seconds)
+	template<typename Faces, typename Distances>
+	void update(const Faces& faces, const Distances& distances, const WorldPoint* world, double now, double seconds, CountingHooks* hooks)
+	{
+		const WorldPoint none = WorldPoint();
+		ids_.assign(faces.size(), -1);
+
+		// verifying faces: on screen only the first detection is looked at, as v2 always
+		// did; in world space the nearest one within reach
+		const int verifyCandidates = world_ ? (int)faces.size() : std::min((int)faces.size(), 1);
+		remove_.clear();
+		for (int i = 0; i < verifying_.size(); i++)
+		{
+			Track& t = verifying_[i];
+			int match = -1;
+			float nearest = 0;
+			for (int j = 0; j < verifyCandidates; j++)
+			{
+				bool found = overlap(faces[j], t.box);
+				float d = std::numeric_limits<float>::max();
+				const WorldPoint& w = world ? world[j] : none;
+				if (world_ && t.world.z > 0 && w.z > 0)
+				{
+					d = world_distance(t.world, w);
+					found = d <= reach_(now - t.worldTime);
+				}
+				if (!found)
+					continue;
+				if (match < 0 || d < nearest)
+				{
+					match = j;
+					nearest = d;
+				}
+				if (!world_)
+					break;
+			}
+
+			if (match >= 0)
+			{
+				const int j = match;
+				t.box = faces[j];
+				t.lastSeen = seconds;
+				ids_[j] = t.id;
+				if (world && world[j].z > 0)
+				{
+					t.world = world[j];
+					t.worldTime = now;
+				}
+
+				if (seconds - t.start > verifySeconds)
+				{
+					// verified -> tracking
+					tracking_.push_back(Track{ t.box, seconds, seconds, t.id, false, t.world, t.worldTime });
+					filters_.push(t.box, distances[j]);
+					remove_.push_back(i);
+					if (hooks)
+						hooks->added((int)tracking_.size() - 1, j, false);
+				}
+			}
+			else if (seconds - t.start > verifySeconds && seconds - t.lastSeen > 0.5)
+			{
+				remove_.push_back(i);
+			}
+		}
+		for (int k = (int)remove_.size() - 1; k >= 0; k--)
+			verifying_.erase(verifying_.begin() + remove_[k]);
+
+		// tracked faces are moved to where they are expected to be by now, so a face
+		// missed for a few frames keeps moving and is matched again where it went
+		// a gap of more than a second (start, stall) is not predicted across. the filters
+		// run with kalman off too, so turning it on by reload starts from where the faces
+		// are, not from where they were promoted
+		if (now - lastUpdate_ > 0 && now - lastUpdate_ < 1)
+			filters_.predict(now - lastUpdate_);
+		if (kalman_)
+		{
+			for (int i = 0; i < tracking_.size(); i++)
+				tracking_[i].box = filters_.box(i);
+		}
+		lastUpdate_ = now;
+
+		// with prediction or world matching a detection belongs to one tracked face only; without
+		// either, only the first detection is looked at and may go to several faces, as v2 always did
+		const bool exclusive = kalman_ || world_;
+		const int candidates = exclusive ? (int)faces.size() : std::min((int)faces.size(), 1);
+		taken_.assign(faces.size(), 0);
+		remove_.clear();
+		for (int i = 0; i < tracking_.size(); i++)
+		{
+			Track& t = tracking_[i];
+			int match = -1;
+			float nearest = 0;
+			for (int j = 0; j < candidates; j++)
+			{
+				if (exclusive && taken_[j])
+					continue;
+				bool found = overlap(faces[j], t.box);
+
+				// in the room: anyone it could have walked to since it was last seen, overlapping
+				// on screen or not; people overlapping on screen at different depths are not
+				float d = std::numeric_limits<float>::max();
+				const WorldPoint& w = world ? world[j] : none;
+				if (world_ && t.world.z > 0 && w.z > 0)
+				{
+					d = world_distance(t.world, w);
+					const bool reachable = d <= reach_(now - t.worldTime);
+					if (found && !reachable)
+						worldRejected_++;
+					found = reachable;
+				}
+				if (!found)
+					continue;
+
+				// someone at a very different distance than predicted is someone else
+				const int predicted = kalman_ ? filters_.distance(i) : 0;
+				if (distances[j] > 0 && predicted > 0 && std::abs(distances[j] - predicted) > depthGate_)
+					continue;
+
+				if (match < 0 || d < nearest)
+				{
+					match = j;
+					nearest = d;
+				}
+				if (!world_)
+					break;
+			}
+
+			if (match >= 0)
+			{
+				const int j = match;
+				taken_[j] = 1;
+				if (hooks)
+					hooks->matched(i, j);
+				t.box = faces[j];
+				t.lastSeen = seconds;
+				ids_[j] = t.id;
+				filters_.correct(i, faces[j], distances[j]);
+				if (world && world[j].z > 0)
+				{
+					t.world = world[j];
+					t.worldTime = now;
+				}
+			}
+			// lost for good -> counted
+			else if (seconds - t.start > lostSeconds && seconds - t.lastSeen > lostSeconds)
+			{
+				remove_.push_back(i);
+			}
+		}
+		for (int k = (int)remove_.size() - 1; k >= 0; k--)
+		{
+			const int i = remove_[k];
+			if (!tracking_[i].counted)
+				count_++;
+			if (hooks)
+				hooks->lost(i);
+			tracking_.erase(tracking_.begin() + i);
+			filters_.erase(i);
+		}
+
+		// new faces in range start verifying, or go straight back to tracking when
+		// re-identified. known means on screen, and in the room too when both positions
+		// are known, so someone behind a known face is not taken for them
+		for (int j = 0; j < faces.size(); j++)
+		{
+			const WorldPoint& w = world ? world[j] : none;
+			bool known = false;
+			for (int i = 0; i < verifying_.size() && !known; i++)
+				known = same_face(faces[j], w, verifying_[i], now);
+			for (int i = 0; i < tracking_.size() && !known; i++)
+				known = same_face(faces[j], w, tracking_[i], now);
+			if (known || !(distances[j] > minDist_ && distances[j] < maxDist_))
+				continue;
+
+			ids_[j] = nextId_;
+			if (hooks && hooks->reidentify(j))
+			{
+				tracking_.push_back(Track{ faces[j], seconds, seconds, nextId_++, true, w, now });
+				filters_.push(faces[j], distances[j]);
+				hooks->added((int)tracking_.size() - 1, j, true);
+				continue;
+			}
+			verifying_.push_back(Track{ faces[j], seconds, seconds, nextId_++, false, w, now });
+		}
+	}
+
+	// the ones still being tracked are counted once they leave
+	int count() const override { return count_; }
+
+	const std::vector<Track>& verifying() const { return verifying_; }
+	const std::vector<Track>& tracking() const { return tracking_; }
+
+	// overlapping on screen, but too far away in the room
+	long long world_rejected() const { return worldRejected_; }
+
+	static constexpr double verifySeconds = 2;
+	static constexpr double lostSeconds = 2;
+
+private:
+	// touching or overlapping, as in the live pipeline
+	static bool overlap(const cv::Rect& a, const cv::Rect& b)
+	{
+		return !(a.x + a.width < b.x) && !(a.x > b.x + b.width) &&
+			!(a.y + a.height < b.y) && !(a.y > b.y + b.height);
+	}
+
+	bool same_face(const cv::Rect& face, const WorldPoint& world, const Track& t, double now) const
+	{
+		return overlap(face, t.box) &&
+			!(world_ && t.world.z > 0 && world.z > 0 && world_distance(t.world, world) > reach_(now - t.worldTime));
+	}
+
+	int minDist_{ 0 };
+	int maxDist_{ 0 };
+	bool kalman_{ false };
+	int depthGate_{ std::numeric_limits<int>::max() };
+	bool world_{ false };
+	WorldReach reach_;
+	std::vector<Track> verifying_;
+	std::vector<Track> tracking_;
+	std::vector<char> taken_;
+	std::vector<int> remove_;
+	TrackFilters filters_;
+	double lastUpdate_{ 0 };
+	int nextId_{ 0 };
+	int count_{ 0 };
+	long long worldRejected_{ 0 };
+};
+
+#endif // COUNTINGCORE_HPP
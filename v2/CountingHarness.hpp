@@ -0,0 +1,279 @@
+#ifndef COUNTINGHARNESS_HPP
+#define COUNTINGHARNESS_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "CountingCore.hpp"
+#include "IdleScheduler.hpp"
+#include "Recording.hpp"
+
+// one frame of a sequence: detections (colour px) and their distances (mm)
+struct SequenceFrame
+{
+	double time{ 0 }; // s
+	std::vector<cv::Rect> faces;
+	std::vector<int> distances;
+	std::vector<int> truth; // person behind every detection, -1 for a false one
+};
+
+struct Sequence
+{
+	std::string name;
+	std::vector<SequenceFrame> frames;
+	int expected{ -1 }; // people that should be counted, -1 when not known
+	bool annotated{ false }; // truth ids known, so id switches can be counted
+};
+
+
+// annotated sequence (.seq), text, one frame per line:
+//   count <n>                                           optional, else distinct ids
+//   <time> [<id> <x> <y> <width> <height> <distance>]...  id -1 for a false detection
+inline bool load_sequence(const std::string& path, Sequence& sequence)
+{
+	std::ifstream in(path);
+	if (!in)
+		return false;
+
+	sequence = Sequence();
+	sequence.name = path;
+	sequence.annotated = true;
+	std::vector<char> seen;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		if (line.compare(0, 5, "count") == 0)
+		{
+			std::string word;
+			fields >> word >> sequence.expected;
+			continue;
+		}
+
+		SequenceFrame frame;
+		fields >> frame.time;
+		int id, x, y, w, h, d;
+		while (fields >> id >> x >> y >> w >> h >> d)
+		{
+			frame.faces.push_back(cv::Rect(x, y, w, h));
+			frame.distances.push_back(d);
+			frame.truth.push_back(id);
+			if (id >= 0)
+			{
+				if (id >= seen.size())
+					seen.resize(id + 1, 0);
+				seen[id] = 1;
+			}
+		}
+		sequence.frames.push_back(frame);
+	}
+
+	if (sequence.expected < 0)
+	{
+		sequence.expected = 0;
+		for (int i = 0; i < seen.size(); i++)
+			sequence.expected += seen[i];
+	}
+	return true;
+}
+
+
+// people walking across a 640x480 frame at 30 fps, one every few seconds, at random
+// heights, sizes, speeds and distances within [minDist, maxDist]. detections jitter,
+// are missed now and then, and the odd false detection turns up
+inline Sequence synthetic_sequence(int people, unsigned seed, int minDist, int maxDist)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	const int width = 640;
+	const double fps = 30;
+	const double missRate = 0.1;
+	const double falseRate = 0.01;
+
+	struct Walker
+	{
+		double enter;
+		double speed; // px/s, negative walks right to left
+		int y;
+		int size;
+		int distance;
+	};
+	std::vector<Walker> walkers;
+	double end = 0;
+	for (int p = 0; p < people; p++)
+	{
+		Walker w;
+		w.size = 50 + (int)(uniform(random) * 60);
+		w.speed = (80 + uniform(random) * 100) * (uniform(random) < 0.5 ? 1 : -1);
+		w.enter = p * 4 + uniform(random) * 2;
+		w.y = 60 + (int)(uniform(random) * 240);
+		w.distance = minDist + 100 + (int)(uniform(random) * (maxDist - minDist - 200));
+		walkers.push_back(w);
+		end = std::max(end, w.enter + (width + w.size) / std::fabs(w.speed));
+	}
+
+	Sequence sequence;
+	std::ostringstream name;
+	name << "synthetic:" << people << ":" << seed;
+	sequence.name = name.str();
+	sequence.expected = people;
+	sequence.annotated = true;
+	for (int f = 0; f <= end * fps; f++)
+	{
+		SequenceFrame frame;
+		frame.time = f / fps;
+		for (int p = 0; p < people; p++)
+		{
+			const Walker& w = walkers[p];
+			const double walked = (frame.time - w.enter) * std::fabs(w.speed);
+			if (walked < 0 || walked > width - w.size)
+				continue;
+			if (uniform(random) < missRate)
+				continue;
+			const int x = w.speed > 0 ? (int)walked : width - w.size - (int)walked;
+			const int jitter = (int)(uniform(random) * 7) - 3;
+			frame.faces.push_back(cv::Rect(x + jitter, w.y + jitter, w.size, w.size));
+			frame.distances.push_back(w.distance);
+			frame.truth.push_back(p);
+		}
+		if (uniform(random) < falseRate)
+		{
+			frame.faces.push_back(cv::Rect((int)(uniform(random) * 560), (int)(uniform(random) * 400), 60, 60));
+			frame.distances.push_back(minDist + (int)(uniform(random) * (maxDist - minDist)));
+			frame.truth.push_back(-1);
+		}
+		sequence.frames.push_back(frame);
+	}
+	return sequence;
+}
+
+
+// a flight recorder dump (Recording.hpp) run through 'detect'; colour and depth records
+// are paired in the order they were written. the expected count is read from
+// <path>.count if there is one; there are no truth ids, so no id switches
+inline bool load_recording(const std::string& path, Sequence& sequence,
+	const std::function<void(const cv::Mat&, std::vector<cv::Rect>&)>& detect, double& detectSeconds)
+{
+	RecordingReader reader;
+	if (!reader.open(path))
+		return false;
+
+	sequence = Sequence();
+	sequence.name = path;
+	std::ifstream count(path + ".count");
+	if (!(count >> sequence.expected))
+		sequence.expected = -1;
+
+	RecordHeader imageHeader, depthHeader;
+	std::vector<int16_t> depth;
+	int width, height;
+	cv::Mat image;
+	int64_t start = -1;
+	detectSeconds = 0;
+	while (reader.next_pair(image, imageHeader, depth, width, height, depthHeader))
+	{
+		if (start < 0)
+			start = imageHeader.time;
+
+		// back to the 4x depth resolution colour frames are detected at
+		if (image.cols != width * 4)
+			cv::resize(image, image, cv::Size(width * 4, height * 4));
+		if (image.channels() == 1)
+			cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+
+		SequenceFrame frame;
+		frame.time = (imageHeader.time - start) / 1e6;
+		const auto before = std::chrono::steady_clock::now();
+		detect(image, frame.faces);
+		detectSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+		for (int i = 0; i < frame.faces.size(); i++)
+		{
+			const cv::Rect& r = frame.faces[i];
+			const int x = (r.x + r.width / 2) / 4;
+			const int y = (r.y + r.height / 2) / 4;
+			frame.distances.push_back(x >= 0 && y >= 0 && x < width && y < height ? depth[y * width + x] : 0);
+			frame.truth.push_back(-1);
+		}
+		sequence.frames.push_back(frame);
+	}
+	return true;
+}
+
+
+// one counter over one sequence
+const double flushSeconds = 5; // empty frames after the sequence
+
+struct RegressionResult
+{
+	int count{ 0 };
+	int idSwitches{ 0 };
+	long long frames{ 0 };
+	double seconds{ 0 };
+	double cpuSeconds{ 0 };
+};
+
+// every frame of the sequence, then a few empty seconds so the people still in view
+// leave and are counted. only the sequence itself is timed
+inline RegressionResult run_counter(Counter& counter, const Sequence& sequence)
+{
+	RegressionResult result;
+	std::vector<int> lastId;
+
+	const double cpuBefore = process_cpu_seconds();
+	const auto before = std::chrono::steady_clock::now();
+	for (int f = 0; f < sequence.frames.size(); f++)
+	{
+		const SequenceFrame& frame = sequence.frames[f];
+		counter.update(frame.faces, frame.distances, frame.time);
+
+		// a person whose detection goes to a different track than last time
+		const std::vector<int>& ids = counter.ids();
+		for (int i = 0; i < frame.truth.size(); i++)
+		{
+			const int person = frame.truth[i];
+			if (person < 0 || ids[i] < 0)
+				continue;
+			if (person >= lastId.size())
+				lastId.resize(person + 1, -1);
+			if (lastId[person] >= 0 && lastId[person] != ids[i])
+				result.idSwitches++;
+			lastId[person] = ids[i];
+		}
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+	result.cpuSeconds = process_cpu_seconds() - cpuBefore;
+	result.frames = sequence.frames.size();
+
+	const double end = sequence.frames.empty() ? 0 : sequence.frames.back().time;
+	const std::vector<cv::Rect> none;
+	const std::vector<int> noDistances;
+	for (double t = 1 / 30.0; t < flushSeconds; t += 1 / 30.0)
+		counter.update(none, noDistances, end + t);
+
+	result.count = counter.count();
+	return result;
+}
+
+inline void print_result(const std::string& name, const Sequence& sequence, const RegressionResult& result)
+{
+	std::cout << "  " << std::left << std::setw(10) << name << std::right << " count " << result.count;
+	if (sequence.expected >= 0)
+		std::cout << " (expected " << sequence.expected << ", error " << std::showpos << result.count - sequence.expected << std::noshowpos << ")";
+	if (sequence.annotated)
+		std::cout << ", id switches " << result.idSwitches;
+	std::cout << ", " << (long long)(result.seconds > 0 ? result.frames / result.seconds : 0) << " fps"
+		<< ", " << (result.frames > 0 ? (long long)(result.cpuSeconds * 1e9 / result.frames) : 0) << " ns cpu per frame" << std::endl;
+}
+
+#endif // COUNTINGHARNESS_HPP
@@ -0,0 +1,154 @@
+#ifndef DEPTHBACKGROUND_HPP
+#define DEPTHBACKGROUND_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+// per-pixel background model of the depth stream
+// the sensor is fixed-mounted, so every pixel keeps an approximate running median of
+// its depth; anything standing well in front of it is foreground. the foreground is
+// grouped into connected regions so detection only has to look at the occupied area.
+// the background is frozen under the foreground: someone standing still in a queue stays
+// foreground however long they wait, and only something that stays put for the absorb
+// time (a moved chair, a parked trolley) becomes part of the background
+class DepthBackground
+{
+public:
+	void init(int width, int height)
+	{
+		if (width == width_ && height == height_)
+			return;
+
+		width_ = width;
+		height_ = height;
+
+		// buffers are sized once per depth mode and reused every frame
+		background_.assign(width_ * height_, 0);
+		since_.assign(width_ * height_, 0.f);
+		mask_.assign(width_ * height_, 0);
+		labels_.create(height_, width_, CV_32S);
+		regions_.clear();
+		regions_.reserve(maxRegions);
+		frames_ = 0;
+	}
+
+	void set_threshold(int mm) { threshold_ = (int16_t)mm; }
+	void set_step(int backgroundStep) { backgroundStep_ = (int16_t)backgroundStep; }
+	void set_absorb(double seconds) { absorbSeconds_ = (float)seconds; }
+	void set_min_area(int pixels) { minArea_ = pixels; }
+
+	// feed one depth frame (millimetres, row-major) captured at 'now' seconds and
+	// rebuild the mask and regions
+	void update(const int16_t* depth, double now)
+	{
+		const int length = width_ * height_;
+		int16_t* __restrict background = background_.data();
+		float* __restrict since = since_.data();
+		uint8_t* __restrict mask = mask_.data();
+
+		if (frames_ == 0)
+		{
+			// first frame becomes the background
+			origin_ = now;
+			for (int i = 0; i < length; i++)
+				background[i] = depth[i];
+		}
+		const float t = (float)(now - origin_);
+
+		// branch-free so the compiler can vectorize it: background pixels follow the scene
+		// quickly, foreground pixels do not move it at all until they have been in front
+		// since longer than the absorb time, then their depth is taken over at once.
+		// holes (zero depth) neither update nor count as foreground, nor stop the clock
+		int count = 0;
+		for (int i = 0; i < length; i++)
+		{
+			const int16_t d = depth[i];
+			const int16_t b = background[i];
+			const int valid = d > 0;
+			const int front = valid & (b > 0) & (b - d > threshold_);
+			const int absorbed = front & (t - since[i] >= absorbSeconds_);
+			const int fg = front & !absorbed;
+			int16_t diff = (int16_t)(d - b);
+			diff = diff > backgroundStep_ ? backgroundStep_ : diff;
+			diff = diff < -backgroundStep_ ? (int16_t)-backgroundStep_ : diff;
+			// an unknown background (hole) takes the first valid reading
+			background[i] = (b == 0) | absorbed ? d : (valid & !front ? (int16_t)(b + diff) : b);
+			// the last time the pixel showed the background
+			since[i] = valid & !fg ? t : since[i];
+			mask[i] = (uint8_t)(fg * 255);
+			count += fg;
+		}
+		foregroundCount_ = count;
+		frames_++;
+
+		find_regions();
+	}
+
+	// 255 where a pixel is in front of the background
+	const std::vector<uint8_t>& mask() const { return mask_; }
+	// bounding boxes of the foreground blobs, in depth pixels
+	const std::vector<cv::Rect>& regions() const { return regions_; }
+	int foreground_count() const { return foregroundCount_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+	static const int maxRegions = 32;
+
+private:
+	void find_regions()
+	{
+		regions_.clear();
+		if (foregroundCount_ < minArea_)
+			return; // empty scene -> nothing to label
+
+		const cv::Mat mask(height_, width_, CV_8UC1, mask_.data());
+		const int found = cv::connectedComponentsWithStats(mask, labels_, stats_, centroids_, 8, CV_32S);
+
+		// label 0 is the background
+		for (int i = 1; i < found && (int)regions_.size() < maxRegions; i++)
+		{
+			if (stats_.at<int>(i, cv::CC_STAT_AREA) < minArea_)
+				continue;
+
+			cv::Rect r(stats_.at<int>(i, cv::CC_STAT_LEFT), stats_.at<int>(i, cv::CC_STAT_TOP),
+				stats_.at<int>(i, cv::CC_STAT_WIDTH), stats_.at<int>(i, cv::CC_STAT_HEIGHT));
+
+			// merge with an overlapping region so nothing is scanned twice
+			bool merged = false;
+			for (int j = 0; j < regions_.size(); j++)
+			{
+				if ((regions_[j] & r).area() > 0)
+				{
+					regions_[j] |= r;
+					merged = true;
+					break;
+				}
+			}
+			if (!merged)
+				regions_.push_back(r);
+		}
+	}
+
+	int width_{ 0 };
+	int height_{ 0 };
+	int frames_{ 0 };
+
+	int16_t threshold_{ 150 };	// mm in front of the background
+	int16_t backgroundStep_{ 20 };	// mm per frame
+	float absorbSeconds_{ 600 };	// in front this long -> background
+	int minArea_{ 20 };		// depth pixels
+
+	std::vector<int16_t> background_;
+	std::vector<float> since_;	// s since origin_
+	double origin_{ 0 };
+	std::vector<uint8_t> mask_;
+	int foregroundCount_{ 0 };
+
+	cv::Mat labels_;
+	cv::Mat stats_;
+	cv::Mat centroids_;
+	std::vector<cv::Rect> regions_;
+};
+
+#endif // DEPTHBACKGROUND_HPP
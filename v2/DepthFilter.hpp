@@ -0,0 +1,133 @@
+#ifndef DEPTHFILTER_HPP
+#define DEPTHFILTER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// steadies the depth frame before anything looks at it, in place
+// temporal: every pixel is blended with its previous value, unless it jumped by more
+// than 'jump' (someone moved - taken as is, so edges do not smear); a hole keeps the
+// previous value for up to 'hold' frames.
+// spatial: a hole still left takes the farthest of its 4 neighbours (holes at edges are
+// mostly the shadow of the thing in front), and a pixel outside the range of its 4
+// neighbours is clamped into it, which removes single-pixel spikes but leaves edges be.
+// both passes are branch-free so the compiler can vectorize them
+class DepthFilter
+{
+public:
+	void configure(int jump, int smoothing, int hold)
+	{
+		jump_ = jump;
+		smoothing_ = smoothing;
+		hold_ = hold;
+	}
+
+	// a depth frame (mm, row-major) straight from the sensor
+	void apply(int16_t* depth, int width, int height)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const int length = width * height;
+		if (width != width_ || height != height_)
+		{
+			// buffers are sized once per depth mode and reused every frame
+			width_ = width;
+			height_ = height;
+			smooth_.assign(depth, depth + length);
+			age_.assign(length, 0);
+		}
+
+		int16_t* __restrict smooth = smooth_.data();
+		uint8_t* __restrict age = age_.data();
+		const int jump = jump_;
+		const int smoothing = smoothing_;
+		const int hold = hold_;
+		int holesIn = 0;
+		for (int i = 0; i < length; i++)
+		{
+			const int d = depth[i];
+			const int p = smooth[i];
+			const int a = age[i];
+			const int valid = d > 0;
+			const int diff = d - p;
+			const int near = valid & (p > 0) & (diff <= jump) & (diff >= -jump);
+			const int blended = p + (diff >> smoothing);
+			// masks rather than selects, which the vectorizer takes as control flow here
+			const int taken = d + ((blended - d) & -near);
+			const int held = p & -(a < hold);
+			smooth[i] = (int16_t)(held + ((taken - held) & -valid));
+			age[i] = (uint8_t)((a + (a < 255)) & (valid - 1));
+			holesIn += 1 - valid;
+		}
+
+		// borders as they are, the inside from the 4 neighbours
+		for (int x = 0; x < width; x++)
+		{
+			depth[x] = smooth[x];
+			depth[(height - 1) * width + x] = smooth[(height - 1) * width + x];
+		}
+		int holesOut = 0;
+		for (int y = 1; y < height - 1; y++)
+		{
+			const int16_t* __restrict above = smooth + (y - 1) * width;
+			const int16_t* __restrict row = smooth + y * width;
+			const int16_t* __restrict below = smooth + (y + 1) * width;
+			int16_t* __restrict out = depth + y * width;
+			out[0] = row[0];
+			out[width - 1] = row[width - 1];
+			for (int x = 1; x < width - 1; x++)
+			{
+				const int d = row[x];
+				const int a = above[x], b = below[x], l = row[x - 1], r = row[x + 1];
+				const int lo1 = a < b ? a : b, lo2 = l < r ? l : r;
+				const int hi1 = a > b ? a : b, hi2 = l > r ? l : r;
+				const int lo = lo1 < lo2 ? lo1 : lo2;
+				const int hi = hi1 > hi2 ? hi1 : hi2;
+				// with a hole among the neighbours the range means nothing
+				const int clamped = lo > 0 ? (d < lo ? lo : (d > hi ? hi : d)) : d;
+				const int v = d > 0 ? clamped : hi;
+				out[x] = (int16_t)v;
+				holesOut += v == 0;
+			}
+		}
+
+		holesIn_ += holesIn;
+		holesOut_ += holesOut;
+		pixels_ += length;
+		micros_ += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		frames_++;
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::cout << "Depth filter: holes " << (pixels_ > 0 ? 100.0 * holesIn_ / pixels_ : 0) << "% -> "
+			<< (pixels_ > 0 ? 100.0 * holesOut_ / pixels_ : 0) << "%"
+			<< ", " << (frames_ > 0 ? micros_ / frames_ : 0) << " us per frame" << std::endl;
+		holesIn_ = 0;
+		holesOut_ = 0;
+		pixels_ = 0;
+		micros_ = 0;
+		frames_ = 0;
+	}
+
+private:
+	int width_{ 0 };
+	int height_{ 0 };
+
+	int jump_{ 100 };	// mm per frame taken as movement
+	int smoothing_{ 1 };	// new reading weighs 1 / 2^smoothing
+	int hold_{ 3 };		// frames
+
+	std::vector<int16_t> smooth_; // temporal result, the state carried to the next frame
+	std::vector<uint8_t> age_; // frames since the last valid reading
+
+	long long holesIn_{ 0 };
+	long long holesOut_{ 0 };
+	long long pixels_{ 0 };
+	double micros_{ 0 };
+	long long frames_{ 0 };
+};
+
+#endif // DEPTHFILTER_HPP
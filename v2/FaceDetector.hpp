@@ -0,0 +1,212 @@
+#ifndef FACEDETECTOR_HPP
+#define FACEDETECTOR_HPP
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+#include <opencv2/dnn.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// face detector backends, selected with "detector" in setting.json
+// every backend takes a batch of images (whole frames or candidate regions, possibly
+// from different frames) and returns the faces found in each, relative to that image
+class FaceDetector
+{
+public:
+	virtual ~FaceDetector() {}
+
+	virtual bool load() = 0;
+	virtual const char* name() const = 0;
+
+	// equalized grey pyramid level instead of the colour frame
+	virtual bool grey_input() const = 0;
+
+	// results is resized to images.size(); results[i] holds the faces of images[i]
+	virtual void detect(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::Rect>>& results) = 0;
+};
+
+
+// haar cascade - the original detector, one detectMultiScale per image
+class CascadeFaceDetector : public FaceDetector
+{
+public:
+	explicit CascadeFaceDetector(const std::string& file)
+		: file_(file)
+	{}
+
+	bool load() override
+	{
+		return cascade_.load(file_);
+	}
+
+	const char* name() const override { return "cascade"; }
+	bool grey_input() const override { return true; }
+
+	void detect(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::Rect>>& results) override
+	{
+		results.resize(images.size());
+		for (int i = 0; i < images.size(); i++)
+		{
+			results[i].clear();
+			if (images[i].cols < minSize_.width || images[i].rows < minSize_.height)
+				continue;
+			cascade_.detectMultiScale(images[i], results[i], scaleFactor_, minNeighbors_, 0 | CV_HAAR_SCALE_IMAGE, minSize_);
+		}
+	}
+
+private:
+	std::string file_;
+	cv::CascadeClassifier cascade_;
+
+	double scaleFactor_{ 1.1 };
+	int minNeighbors_{ 2 };
+	cv::Size minSize_{ 30, 30 };
+};
+
+
+// ssd face model on opencv's dnn module, cpu only
+// all images of a call go through a single forward pass; the input blob is kept
+// between calls so a steady batch size does not reallocate it
+class DnnFaceDetector : public FaceDetector
+{
+public:
+	DnnFaceDetector(const std::string& config, const std::string& model, float confidence, int threads, int pinCpu)
+		: config_(config), model_(model), confidence_(confidence), threads_(threads), pinCpu_(pinCpu)
+	{}
+
+	bool load() override
+	{
+		net_ = cv::dnn::readNetFromCaffe(config_, model_);
+		if (net_.empty())
+			return false;
+
+		net_.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+		net_.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+		// fixed worker count, and the calling (detection) thread kept on one core
+		if (threads_ > 0)
+			cv::setNumThreads(threads_);
+		if (pinCpu_ >= 0)
+			pin_current_thread(pinCpu_);
+		return true;
+	}
+
+	const char* name() const override { return "dnn"; }
+	bool grey_input() const override { return false; }
+
+	void detect(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::Rect>>& results) override
+	{
+		results.resize(images.size());
+		for (int i = 0; i < results.size(); i++)
+			results[i].clear();
+		if (images.empty())
+			return;
+
+		cv::dnn::blobFromImages(images, blob_, 1.0, inputSize_, mean_, false, false);
+		net_.setInput(blob_);
+		output_ = net_.forward();
+
+		// output is 1 x 1 x N x 7: [image, label, confidence, left, top, right, bottom]
+		const int detections = output_.size[2];
+		const float* data = output_.ptr<float>();
+		for (int i = 0; i < detections; i++)
+		{
+			const float* d = data + i * 7;
+			const int image = (int)d[0];
+			if (d[2] < confidence_ || image < 0 || image >= images.size())
+				continue;
+
+			const int w = images[image].cols;
+			const int h = images[image].rows;
+			cv::Rect r(cvRound(d[3] * w), cvRound(d[4] * h), cvRound((d[5] - d[3]) * w), cvRound((d[6] - d[4]) * h));
+			r &= cv::Rect(0, 0, w, h);
+			if (r.area() > 0)
+				results[image].push_back(r);
+		}
+	}
+
+	static void pin_current_thread(int cpu)
+	{
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+
+private:
+	std::string config_;
+	std::string model_;
+	float confidence_;
+	int threads_;
+	int pinCpu_;
+
+	cv::dnn::Net net_;
+	cv::Mat blob_;
+	cv::Mat output_;
+	cv::Size inputSize_{ 300, 300 };
+	cv::Scalar mean_{ 104.0, 177.0, 123.0 };
+};
+
+
+// side by side figures for two detectors run on the same frames
+// there is no ground truth on live or recorded frames, so agreement is reported:
+// a face counts as matched when the other detector has a box overlapping it by IoU 0.5
+struct DetectorStats
+{
+	int frames{ 0 };
+	double millis{ 0 };
+	int faces{ 0 };
+	int matched{ 0 };
+
+	void print(const char* name) const
+	{
+		std::cout << name << ": "
+			<< (frames > 0 ? millis / frames : 0) << " ms/frame, "
+			<< (millis > 0 ? frames * 1000.0 / millis : 0) << " fps, "
+			<< faces << " faces, "
+			<< matched << " agreed with the other detector" << std::endl;
+	}
+};
+
+inline double rect_iou(const cv::Rect& a, const cv::Rect& b)
+{
+	const double inter = (a & b).area();
+	const double uni = a.area() + b.area() - inter;
+	return uni > 0 ? inter / uni : 0;
+}
+
+template<typename Faces, typename Others>
+int count_matched(const Faces& faces, const Others& others)
+{
+	int matched = 0;
+	for (int i = 0; i < faces.size(); i++)
+	{
+		for (int j = 0; j < others.size(); j++)
+		{
+			if (rect_iou(faces[i], others[j]) >= 0.5)
+			{
+				matched++;
+				break;
+			}
+		}
+	}
+	return matched;
+}
+
+#endif // FACEDETECTOR_HPP
@@ -0,0 +1,348 @@
+#ifndef FLIGHTRECORDER_HPP
+#define FLIGHTRECORDER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameSync.hpp"
+#include "Recording.hpp"
+#include "Tracing.hpp"
+
+// the last few seconds of frames and pipeline events, kept in memory for replay
+// the detection thread only copies each frame pair into one of two staging slots; the
+// recorder thread compresses them (jpeg colour, delta-coded depth) into a fixed-size
+// byte ring, oldest records going first once it is full or older than 'seconds'.
+// dump() writes the ring out as a recording (Recording.hpp) from the recorder thread
+class FlightRecorder
+{
+public:
+	typedef std::chrono::steady_clock ClockType;
+
+	~FlightRecorder() { stop(); }
+
+	void start(size_t memory, double seconds, int quality, const std::string& directory)
+	{
+		if (thread_.joinable())
+			return;
+
+		ring_.assign(memory, 0);
+		seconds_ = seconds;
+		directory_ = directory;
+		jpegParams_ = { cv::IMWRITE_JPEG_QUALITY, quality };
+		running_ = true;
+		thread_ = std::thread(&FlightRecorder::run, this);
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+		}
+		wake_.notify_all();
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+	bool running() const { return thread_.joinable(); }
+
+	// detection side: a colour (or grey) frame and its depth frame; false when both
+	// staging slots are still being compressed and the pair is left out
+	bool offer(const cv::Mat& image, const DepthSlot& depth, long long index, ClockType::time_point captured)
+	{
+		if (!running())
+			return false;
+
+		int slot = -1;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (int i = 0; i < stagingSlots; i++)
+			{
+				if (staging_[i].state == Free)
+				{
+					slot = i;
+					break;
+				}
+			}
+			if (slot < 0)
+			{
+				dropped_++;
+				return false;
+			}
+			staging_[slot].state = Filling;
+		}
+
+		// plain copies into buffers that keep their size, outside the lock
+		Staged& staged = staging_[slot];
+		image.copyTo(staged.image);
+		staged.depth.resize(depth.depth.size());
+		std::memcpy(staged.depth.data(), depth.depth.data(), depth.depth.size() * sizeof(int16_t));
+		staged.width = depth.width;
+		staged.height = depth.height;
+		staged.index = index;
+		staged.depthIndex = depth.index;
+		staged.time = micros(captured);
+		staged.depthTime = micros(depth.captured);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			staged.state = Ready;
+			staged.sequence = sequence_++;
+		}
+		wake_.notify_one();
+		return true;
+	}
+
+	// a pipeline event, recorded with the frames; dropped if too many are waiting
+	void event(const char* text)
+	{
+		if (!running())
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (eventCount_ == maxEvents)
+			return;
+		PendingEvent& e = events_[eventCount_++];
+		std::strncpy(e.text, text, sizeof(e.text) - 1);
+		e.text[sizeof(e.text) - 1] = 0;
+		e.time = micros(ClockType::now());
+		wake_.notify_one();
+	}
+
+	// writes the ring to disk as soon as the recorder thread gets to it
+	void dump(const char* reason)
+	{
+		if (!running())
+			return;
+
+		event(reason);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			dumpRequested_ = true;
+		}
+		wake_.notify_one();
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::cout << "Flight recorder: " << (recordedSpan_ / 1e6) << " s, " << (recordedBytes_ >> 20) << " MB held"
+			<< ", frames recorded: " << recorded_
+			<< ", dropped: " << dropped_ << std::endl;
+		recorded_ = 0;
+		dropped_ = 0;
+	}
+
+	static const int stagingSlots = 2;
+	static const int maxEvents = 64;
+
+private:
+	enum SlotState { Free, Filling, Ready, Encoding };
+
+	struct Staged
+	{
+		SlotState state{ Free };
+		long long sequence{ 0 };
+		cv::Mat image;
+		std::vector<int16_t> depth;
+		int width{ 0 };
+		int height{ 0 };
+		long long index{ 0 };
+		long long depthIndex{ 0 };
+		int64_t time{ 0 };
+		int64_t depthTime{ 0 };
+	};
+
+	struct PendingEvent
+	{
+		char text[96];
+		int64_t time;
+	};
+
+	struct Entry
+	{
+		size_t offset;
+		RecordHeader header;
+	};
+
+	static int64_t micros(ClockType::time_point t)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+	}
+
+	void run()
+	{
+		tracer().name_thread("flight recorder");
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			wake_.wait(lock, [this] { return !running_ || dumpRequested_ || eventCount_ > 0 || next_ready() >= 0; });
+			if (!running_)
+				return;
+
+			// events first, so they land before the frame that follows them
+			const int events = eventCount_;
+			std::memcpy(eventsOut_, events_, events * sizeof(PendingEvent));
+			eventCount_ = 0;
+
+			const int slot = next_ready();
+			if (slot >= 0)
+				staging_[slot].state = Encoding;
+			const bool dump = dumpRequested_;
+			dumpRequested_ = false;
+			lock.unlock();
+
+			// the ring is only ever touched here, on this thread
+			for (int i = 0; i < events; i++)
+				append(RecordType::Event, eventsOut_[i].time, -1, (const uint8_t*)eventsOut_[i].text, std::strlen(eventsOut_[i].text));
+
+			if (slot >= 0)
+			{
+				TraceSpan span("recorder encode");
+				Staged& staged = staging_[slot];
+				if (!staged.image.empty() && cv::imencode(".jpg", staged.image, encoded_, jpegParams_))
+					append(RecordType::Colour, staged.time, staged.index, encoded_.data(), encoded_.size());
+				encode_depth(staged.depth.data(), staged.width, staged.height, encoded_);
+				append(RecordType::Depth, staged.depthTime, staged.depthIndex, encoded_.data(), encoded_.size());
+			}
+
+			if (dump)
+			{
+				TraceSpan span("recorder dump");
+				write_dump();
+			}
+
+			lock.lock();
+			if (slot >= 0)
+			{
+				staging_[slot].state = Free;
+				recorded_++;
+			}
+			recordedBytes_ = used_bytes();
+			recordedSpan_ = entries_.empty() ? 0 : entries_.back().header.time - entries_.front().header.time;
+		}
+	}
+
+	// oldest staged frame waiting for compression, -1 if none
+	int next_ready() const
+	{
+		int slot = -1;
+		for (int i = 0; i < stagingSlots; i++)
+		{
+			if (staging_[i].state == Ready && (slot < 0 || staging_[i].sequence < staging_[slot].sequence))
+				slot = i;
+		}
+		return slot;
+	}
+
+	// into the ring, making room by dropping the oldest records
+	void append(RecordType type, int64_t time, int64_t index, const uint8_t* data, size_t size)
+	{
+		if (size > ring_.size())
+			return;
+
+		// older than the window
+		while (!entries_.empty() && entries_.front().header.time < time - (int64_t)(seconds_ * 1e6))
+			entries_.pop_front();
+
+		// records sit back to back; the free space is [write_, oldest) or, once the
+		// live records no longer wrap, [write_, end) followed by [0, oldest)
+		while (true)
+		{
+			if (entries_.empty())
+			{
+				write_ = write_ + size <= ring_.size() ? write_ : 0;
+				break;
+			}
+			const size_t oldest = entries_.front().offset;
+			if (oldest >= write_)
+			{
+				if (write_ + size <= oldest)
+					break;
+				entries_.pop_front();
+			}
+			else if (write_ + size <= ring_.size())
+			{
+				break;
+			}
+			else
+			{
+				write_ = 0;
+			}
+		}
+
+		Entry entry;
+		entry.offset = write_;
+		entry.header.type = (uint32_t)type;
+		entry.header.size = (uint32_t)size;
+		entry.header.time = time;
+		entry.header.index = index;
+		std::memcpy(ring_.data() + write_, data, size);
+		entries_.push_back(entry);
+		write_ += size;
+	}
+
+	size_t used_bytes() const
+	{
+		size_t bytes = 0;
+		for (int i = 0; i < entries_.size(); i++)
+			bytes += entries_[i].header.size;
+		return bytes;
+	}
+
+	void write_dump()
+	{
+		const std::string path = directory_ + "/flight_" + std::to_string(std::time(nullptr)) + ".rec";
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+		{
+			std::cout << "Flight recorder: unable to write " << path << std::endl;
+			return;
+		}
+		out.write(recordingMagic, sizeof(recordingMagic));
+		for (int i = 0; i < entries_.size(); i++)
+		{
+			const Entry& e = entries_[i];
+			write_record(out, (RecordType)e.header.type, e.header.time, e.header.index, ring_.data() + e.offset, e.header.size);
+		}
+		std::cout << "Flight recorder: " << entries_.size() << " records written to " << path << std::endl;
+	}
+
+	std::vector<uint8_t> ring_;
+	size_t write_{ 0 };
+	std::deque<Entry> entries_;
+	std::vector<uint8_t> encoded_;
+	std::vector<int> jpegParams_;
+	double seconds_{ 30 };
+	std::string directory_;
+
+	Staged staging_[stagingSlots];
+	long long sequence_{ 0 };
+	PendingEvent events_[maxEvents];
+	PendingEvent eventsOut_[maxEvents];
+	int eventCount_{ 0 };
+	bool dumpRequested_{ false };
+	bool running_{ false };
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread thread_;
+
+	long long recorded_{ 0 };
+	long long dropped_{ 0 };
+	size_t recordedBytes_{ 0 };
+	int64_t recordedSpan_{ 0 };
+};
+
+#endif // FLIGHTRECORDER_HPP
@@ -0,0 +1,128 @@
+#ifndef FRAMEARENA_HPP
+#define FRAMEARENA_HPP
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+// per-frame bump allocator for transient containers
+// everything allocated during a frame is released at once by reset(). if a frame
+// needs more than the block holds, the extra comes from the heap for that frame and
+// the block is grown at the next reset, so the steady state never touches the heap
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t capacity)
+		: capacity_(capacity), buffer_(new char[capacity])
+	{
+		spills_.reserve(maxSpills);
+	}
+
+	void* allocate(size_t bytes, size_t align)
+	{
+		const size_t offset = (used_ + align - 1) & ~(align - 1);
+		if (offset + bytes > capacity_)
+		{
+			overflow_ += bytes;
+			void* p = ::operator new(bytes);
+			spills_.push_back(p);
+			return p;
+		}
+		used_ = offset + bytes;
+		return buffer_.get() + offset;
+	}
+
+	// start of a frame - nothing allocated in the previous frame may still be in use
+	void reset()
+	{
+		for (int i = 0; i < spills_.size(); i++)
+			::operator delete(spills_[i]);
+		spills_.clear();
+
+		if (overflow_ > 0)
+		{
+			capacity_ = (capacity_ + overflow_) * 2;
+			buffer_.reset(new char[capacity_]);
+			overflow_ = 0;
+		}
+		used_ = 0;
+	}
+
+	size_t capacity() const { return capacity_; }
+
+	static const int maxSpills = 64;
+
+private:
+	size_t capacity_;
+	size_t used_{ 0 };
+	size_t overflow_{ 0 };
+	std::unique_ptr<char[]> buffer_;
+	std::vector<void*> spills_;
+};
+
+
+// std allocator on top of a FrameArena; deallocation is a no-op until reset()
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	ArenaAllocator(FrameArena& arena) : arena_(&arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, size_t) {}
+
+	FrameArena* arena() const { return arena_; }
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena(); }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena(); }
+
+private:
+	FrameArena* arena_;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+// heap allocations per frame, fed from the counting operator new (COUNT_ALLOCATIONS)
+struct AllocationStats
+{
+	long long last{ 0 };
+	long long frames{ 0 };
+	long long total{ 0 };
+	long long max{ 0 };
+	long long current{ 0 };
+
+	// call once at the end of every frame with the running allocation count
+	void frame_done(long long count)
+	{
+		current = count - last;
+		last = count;
+		total += current;
+		max = current > max ? current : max;
+		frames++;
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::cout << "Heap allocations per frame: " << (frames > 0 ? (double)total / frames : 0)
+			<< " average, " << max << " max, " << current << " last" << std::endl;
+		frames = 0;
+		total = 0;
+		max = 0;
+	}
+};
+
+#endif // FRAMEARENA_HPP
@@ -0,0 +1,152 @@
+#ifndef FRAMEKERNELS_HPP
+#define FRAMEKERNELS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// whole-frame pixel loops, compiled once per sensor mode
+// the frame size and the channel order are template arguments, so the trip count is a
+// constant the compiler can unroll and vectorize against. the listeners pick a kernel
+// when the frame size changes and call it through a pointer from then on; any other
+// size falls back to the same loop with the size read at runtime (Width 0).
+// R, G and B are source byte indices: output bytes 0, 1 and 2 of a pixel are taken
+// from source bytes R, G and B. so <2, 1, 0> turns the sensor's rgb into bgr, and
+// <0, 1, 2> copies it as it is
+typedef void (*FrameKernel)(const uint8_t* src, uint8_t* dst, int width, int height);
+
+// rgb888 to a tightly packed 3-byte image, e.g. the BGR cv::Mat opencv works on
+template<int Width, int Height, int R, int G, int B>
+void swizzle_rgb(const uint8_t* __restrict src, uint8_t* __restrict dst, int width, int height)
+{
+	const int pixels = Width > 0 ? Width * Height : width * height;
+	for (int i = 0; i < pixels; i++)
+	{
+		dst[3 * i] = src[3 * i + R];
+		dst[3 * i + 1] = src[3 * i + G];
+		dst[3 * i + 2] = src[3 * i + B];
+	}
+}
+
+// rgb888 to the opaque RGBA an sf::Texture takes
+// one 32-bit store per pixel instead of four byte stores (little-endian, as every
+// platform we build for)
+template<int Width, int Height, int R, int G, int B>
+void pack_rgba(const uint8_t* __restrict src, uint8_t* __restrict dst, int width, int height)
+{
+	const int pixels = Width > 0 ? Width * Height : width * height;
+	for (int i = 0; i < pixels; i++)
+	{
+		const uint32_t rgba = src[3 * i + R] | (src[3 * i + G] << 8) | (src[3 * i + B] << 16) | 0xFF000000u;
+		std::memcpy(dst + 4 * i, &rgba, 4);
+	}
+}
+
+// the modes the sensors run: 160x120 and 320x240 depth, 640x480 colour
+template<template<int, int, int, int, int> class Kernel, int R, int G, int B>
+FrameKernel select_kernel(int width, int height)
+{
+	if (width == 160 && height == 120)
+		return &Kernel<160, 120, R, G, B>::run;
+	if (width == 320 && height == 240)
+		return &Kernel<320, 240, R, G, B>::run;
+	if (width == 640 && height == 480)
+		return &Kernel<640, 480, R, G, B>::run;
+	return &Kernel<0, 0, R, G, B>::run;
+}
+
+// function templates can't be template template arguments, hence the wrappers
+template<int Width, int Height, int R, int G, int B>
+struct SwizzleKernel
+{
+	static void run(const uint8_t* src, uint8_t* dst, int width, int height) { swizzle_rgb<Width, Height, R, G, B>(src, dst, width, height); }
+};
+
+template<int Width, int Height, int R, int G, int B>
+struct RgbaKernel
+{
+	static void run(const uint8_t* src, uint8_t* dst, int width, int height) { pack_rgba<Width, Height, R, G, B>(src, dst, width, height); }
+};
+
+// colour frame into the BGR detection image
+inline FrameKernel colour_to_bgr(int width, int height) { return select_kernel<SwizzleKernel, 2, 1, 0>(width, height); }
+
+// colour frame into the colour viewer's texture
+inline FrameKernel colour_to_rgba(int width, int height) { return select_kernel<RgbaKernel, 0, 1, 2>(width, height); }
+
+// lit depth image into the depth viewer's texture (green and blue swapped, as it always was)
+inline FrameKernel depth_to_rgba(int width, int height) { return select_kernel<RgbaKernel, 0, 2, 1>(width, height); }
+
+
+// the loops main.cpp ran before the kernels, as the benchmark's baseline
+inline void swizzle_indexed(const uint8_t* src, uint8_t* dst, int width, int height)
+{
+	for (int i = 0; i < width * height; i++)
+	{
+		int index = i % width + width * (i / width);
+		dst[(i / width) * width * 3 + 3 * (i % width)] = src[3 * index + 2];
+		dst[(i / width) * width * 3 + 3 * (i % width) + 1] = src[3 * index + 1];
+		dst[(i / width) * width * 3 + 3 * (i % width) + 2] = src[3 * index];
+	}
+}
+
+inline void rgba_bytes(const uint8_t* src, uint8_t* dst, int width, int height)
+{
+	for (int i = 0; i < width * height; i++)
+	{
+		int rgbaOffset = i * 4;
+		dst[rgbaOffset] = src[3 * i];
+		dst[rgbaOffset + 1] = src[3 * i + 1];
+		dst[rgbaOffset + 2] = src[3 * i + 2];
+		dst[rgbaOffset + 3] = 255;
+	}
+}
+
+// ns per frame of every kernel in every mode: the specialised kernel, the runtime-size
+// fallback and the loop it replaced
+inline void benchmark_frame_kernels(int repeats)
+{
+	struct Entry
+	{
+		const char* name;
+		FrameKernel (*select)(int, int);
+		FrameKernel generic;
+		FrameKernel before;
+	};
+	const Entry entries[] = {
+		{ "colour to bgr", &colour_to_bgr, &SwizzleKernel<0, 0, 2, 1, 0>::run, &swizzle_indexed },
+		{ "colour to rgba", &colour_to_rgba, &RgbaKernel<0, 0, 0, 1, 2>::run, &rgba_bytes },
+		{ "depth to rgba", &depth_to_rgba, &RgbaKernel<0, 0, 0, 2, 1>::run, &rgba_bytes },
+	};
+	const int modes[][2] = { { 160, 120 }, { 320, 240 }, { 640, 480 } };
+
+	for (int m = 0; m < 3; m++)
+	{
+		const int width = modes[m][0];
+		const int height = modes[m][1];
+		std::vector<uint8_t> src(width * height * 3);
+		std::vector<uint8_t> dst(width * height * 4);
+		for (int i = 0; i < src.size(); i++)
+			src[i] = (uint8_t)(i * 7);
+
+		for (int e = 0; e < 3; e++)
+		{
+			double ns[3];
+			const FrameKernel kernels[3] = { entries[e].select(width, height), entries[e].generic, entries[e].before };
+			for (int k = 0; k < 3; k++)
+			{
+				kernels[k](src.data(), dst.data(), width, height);
+				const auto start = std::chrono::steady_clock::now();
+				for (int r = 0; r < repeats; r++)
+					kernels[k](src.data(), dst.data(), width, height);
+				ns[k] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / repeats;
+			}
+			std::cout << entries[e].name << " " << width << "x" << height << ": " << (long long)ns[0] << " ns/frame, generic "
+				<< (long long)ns[1] << " ns, before " << (long long)ns[2] << " ns (" << (ns[0] > 0 ? ns[2] / ns[0] : 0) << "x)" << std::endl;
+		}
+	}
+}
+
+#endif // FRAMEKERNELS_HPP
@@ -0,0 +1,145 @@
+#ifndef FRAMEMAILBOX_HPP
+#define FRAMEMAILBOX_HPP
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// what happens to a frame that arrives while the previous one is still unprocessed
+enum class DropPolicy
+{
+	DropOldest,	// newest wins - the waiting frame is replaced
+	DropNewest,	// the waiting frame is kept, the new one is dropped
+	EveryNth	// only every Nth sensor frame is offered, newest wins among those
+};
+
+inline DropPolicy parse_drop_policy(const std::string& name)
+{
+	if (name == "newest")
+		return DropPolicy::DropNewest;
+	if (name == "nth")
+		return DropPolicy::EveryNth;
+	return DropPolicy::DropOldest;
+}
+
+
+// single-slot mailbox between capture and detection
+// three buffers rotate between the writer (being filled), the mailbox (waiting) and
+// the reader (being processed), so handing a frame over is a swap and never a copy.
+// Frame needs 'index' (sensor frame index) and 'captured' (steady_clock time point)
+template<typename Frame>
+class FrameMailbox
+{
+public:
+	typedef std::chrono::steady_clock ClockType;
+
+	void set_policy(DropPolicy policy, int everyNth)
+	{
+		policy_ = policy;
+		everyNth_ = everyNth > 0 ? everyNth : 1;
+	}
+
+	// capture side: fill this, then publish()
+	Frame& back() { return writing_; }
+
+	void publish()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const long long index = writing_.index;
+
+		// sensor frames the sdk never delivered to us
+		if (published_ > 0 && index > lastIndex_ + 1)
+			skipped_ += index - lastIndex_ - 1;
+
+		// an older frame than one already seen is never processed after it
+		if (published_ > 0 && index <= lastIndex_)
+		{
+			stale_++;
+			return;
+		}
+		lastIndex_ = index;
+		published_++;
+
+		// left out on purpose, not lost
+		if (policy_ == DropPolicy::EveryNth && index % everyNth_ != 0)
+		{
+			thinned_++;
+			return;
+		}
+
+		if (waiting_)
+		{
+			dropped_++;
+			if (policy_ == DropPolicy::DropNewest)
+				return;
+		}
+		std::swap(writing_, ready_);
+		waiting_ = true;
+	}
+
+	// detection side: the frame stays valid until the next take()
+	Frame* take()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!waiting_)
+			return nullptr;
+
+		std::swap(ready_, reading_);
+		waiting_ = false;
+		processed_++;
+
+		// age of the frame at the moment detection starts
+		const double age = std::chrono::duration<double, std::milli>(ClockType::now() - reading_.captured).count();
+		ageTotal_ += age;
+		ageMax_ = age > ageMax_ ? age : ageMax_;
+		lastAge_ = age;
+		return &reading_;
+	}
+
+	double last_age() const { return lastAge_; }
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::cout << "Frames processed: " << processed_
+			<< ", dropped: " << dropped_
+			<< ", not every nth: " << thinned_
+			<< ", skipped by sensor: " << skipped_
+			<< ", stale: " << stale_
+			<< ", age at detection: " << (processed_ > 0 ? ageTotal_ / processed_ : 0) << " ms average, "
+			<< ageMax_ << " ms max" << std::endl;
+		processed_ = 0;
+		dropped_ = 0;
+		thinned_ = 0;
+		skipped_ = 0;
+		stale_ = 0;
+		ageTotal_ = 0;
+		ageMax_ = 0;
+	}
+
+private:
+	std::mutex mutex_;
+	DropPolicy policy_{ DropPolicy::DropOldest };
+	int everyNth_{ 1 };
+
+	Frame writing_;
+	Frame ready_;
+	Frame reading_;
+	bool waiting_{ false };
+
+	long long lastIndex_{ -1 };
+	long long published_{ 0 };
+	long long processed_{ 0 };
+	long long dropped_{ 0 };	// arrived while another frame was waiting
+	long long thinned_{ 0 };	// not an nth frame
+	long long skipped_{ 0 };
+	long long stale_{ 0 };
+	double ageTotal_{ 0 };
+	double ageMax_{ 0 };
+	double lastAge_{ 0 };
+};
+
+#endif // FRAMEMAILBOX_HPP
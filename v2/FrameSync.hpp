@@ -0,0 +1,154 @@
+#ifndef FRAMESYNC_HPP
+#define FRAMESYNC_HPP
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// a point of the sdk's point frame: mm in camera space, z 0 for a hole
+// (same layout as astra::Vector3f, so a point frame is copied as a block;
+// WorldPoint() is all zeros)
+struct WorldPoint
+{
+	float x;
+	float y;
+	float z;
+};
+
+// one buffered depth frame
+struct DepthSlot
+{
+	std::vector<int16_t> depth; // mm, row-major
+	std::vector<WorldPoint> points; // same pixels, only filled for world-space tracking
+	int width{ 0 };
+	int height{ 0 };
+	long long index{ -1 }; // sensor frame index
+	std::chrono::steady_clock::time_point captured; // when the sdk delivered it
+
+	// depth at a depth pixel, 0 outside the frame (same as a hole)
+	int at(int x, int y) const
+	{
+		if (x < 0 || y < 0 || x >= width || y >= height)
+			return 0;
+		return depth[y * width + x];
+	}
+};
+
+enum class SyncResult
+{
+	Matched,	// a depth frame within tolerance was found
+	Wait,		// its depth frame has not arrived yet, try again next update
+	Unmatched	// nothing close enough arrived in time - skip the colour frame
+};
+
+
+// pairs colour frames with depth frames from the other stream reader
+// colour and depth come from separate readers with their own frame indices and the sdk
+// gives no capture time, so both are keyed by the time their callback ran. both callbacks
+// run inside the same astra_update(), so this is the order the sdk delivered them in,
+// not when they were captured: a pair is the depth frame delivered nearest to the colour
+// frame, which keeps stale or future depth out but does not prove they were taken together.
+// the last few depth frames are kept in a ring; a colour frame is matched with the
+// closest one within the tolerance
+class FrameSync
+{
+public:
+	typedef std::chrono::steady_clock ClockType;
+
+	explicit FrameSync(int window = 4)
+		: slots_(window)
+	{}
+
+	void set_tolerance(double millis) { tolerance_ = millis; }
+
+	// depth side: fill the returned slot's buffer, then commit()
+	DepthSlot& back(int width, int height)
+	{
+		DepthSlot& slot = slots_[head_];
+		if (slot.width != width || slot.height != height)
+		{
+			slot.width = width;
+			slot.height = height;
+			slot.depth.assign(width * height, 0);
+		}
+		return slot;
+	}
+
+	void commit(long long index)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		slots_[head_].index = index;
+		slots_[head_].captured = ClockType::now();
+		head_ = (head_ + 1) % slots_.size();
+		if (count_ < slots_.size())
+			count_++;
+	}
+
+	// colour side: the depth frame paired with a colour frame delivered at 'captured'
+	SyncResult match(ClockType::time_point captured, const DepthSlot*& paired)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		paired = nullptr;
+
+		double best = 0;
+		bool newer = false;
+		for (int i = 0; i < count_; i++)
+		{
+			const DepthSlot& slot = slots_[i];
+			const double gap = std::chrono::duration<double, std::milli>(slot.captured - captured).count();
+			newer = newer || gap >= 0;
+			if (std::fabs(gap) <= tolerance_ && (paired == nullptr || std::fabs(gap) < std::fabs(best)))
+			{
+				paired = &slot;
+				best = gap;
+			}
+		}
+
+		if (paired != nullptr)
+		{
+			matched_++;
+			gapTotal_ += std::fabs(best);
+			gapMax_ = std::fabs(best) > gapMax_ ? std::fabs(best) : gapMax_;
+			return SyncResult::Matched;
+		}
+
+		// the partner may still be on its way as long as the tolerance has not run out
+		const double age = std::chrono::duration<double, std::milli>(ClockType::now() - captured).count();
+		if (!newer && age <= tolerance_)
+			return SyncResult::Wait;
+
+		unmatched_++;
+		return SyncResult::Unmatched;
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::cout << "Colour/depth pairs: " << matched_
+			<< ", unmatched: " << unmatched_
+			<< ", delivered apart: " << (matched_ > 0 ? gapTotal_ / matched_ : 0) << " ms average, "
+			<< gapMax_ << " ms max" << std::endl;
+		matched_ = 0;
+		unmatched_ = 0;
+		gapTotal_ = 0;
+		gapMax_ = 0;
+	}
+
+private:
+	std::mutex mutex_;
+	std::vector<DepthSlot> slots_;
+	int head_{ 0 };
+	int count_{ 0 };
+	double tolerance_{ 20 };
+
+	long long matched_{ 0 };
+	long long unmatched_{ 0 };
+	double gapTotal_{ 0 }; // between the callbacks, not the captures
+	double gapMax_{ 0 };
+};
+
+#endif // FRAMESYNC_HPP
@@ -0,0 +1,205 @@
+#ifndef IDLESCHEDULER_HPP
+#define IDLESCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include "FrameSync.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+// cpu time used by the whole process so far, in seconds
+inline double process_cpu_seconds()
+{
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7; // 100 ns units
+#else
+	return (double)std::clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+// runs detection at full rate only while something moves in front of the camera
+// every depth frame is reduced to a coarse grid of mean depths (pixels outside the
+// depth band count as 0) and compared with the previous one. while no cell changes
+// for 'idleAfter' seconds detection drops to one frame per 'idleInterval'; the first
+// frame with motion goes straight back to full rate. while anyone is being verified or
+// tracked ('busy') it never idles: a detection missed for longer than the track timeout
+// would count them and verify them again
+class IdleScheduler
+{
+public:
+	void configure(int minDist, int maxDist, int cellThreshold, int minCells, double idleAfter, double idleInterval)
+	{
+		minDist_ = minDist;
+		maxDist_ = maxDist;
+		cellThreshold_ = cellThreshold;
+		minCells_ = minCells;
+		idleAfter_ = idleAfter;
+		idleInterval_ = idleInterval;
+	}
+
+	// whether this frame should go through detection; 'now' in seconds
+	bool update(const DepthSlot& depth, double now, bool busy)
+	{
+		waking_ = false;
+		const bool motion = changed(depth) || busy;
+		if (motion)
+			lastMotion_ = now;
+
+		if (idle_)
+		{
+			if (motion)
+			{
+				idle_ = false;
+				waking_ = true;
+				wakeUps_++;
+			}
+			else if (now - lastDetection_ < idleInterval_)
+			{
+				skipped_++;
+				return false;
+			}
+		}
+		else if (now - lastMotion_ > idleAfter_)
+		{
+			idle_ = true;
+		}
+
+		lastDetection_ = now;
+		detected_++;
+		return true;
+	}
+
+	bool idle() const { return idle_; }
+
+	// the frame update() just let through is the first one after idling
+	bool waking() const { return waking_; }
+
+	// capture to end of detection of the frame that woke the scheduler up
+	void wake_latency(double millis) { wakeLatency_ = millis; }
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		const double cpu = process_cpu_seconds();
+		const double wall = wall_seconds();
+		const double usage = wall > lastWall_ && lastWall_ > 0 ? (cpu - lastCpu_) / (wall - lastWall_) * 100 : 0;
+		std::cout << "Scheduler: " << (idle_ ? "idle" : "active")
+			<< ", frames detected: " << detected_
+			<< ", skipped: " << skipped_
+			<< ", scene change: " << sadPerCell_ << " mm per cell"
+			<< ", cpu: " << usage << "%"
+			<< ", wake-ups: " << wakeUps_
+			<< ", last wake-up latency: " << wakeLatency_ << " ms" << std::endl;
+		lastCpu_ = cpu;
+		lastWall_ = wall;
+		detected_ = 0;
+		skipped_ = 0;
+	}
+
+private:
+	// compares the depth grid of this frame with the previous one
+	bool changed(const DepthSlot& depth)
+	{
+		const int cols = depth.width / cellSize;
+		const int rows = depth.height / cellSize;
+		if (cols * rows == 0)
+			return false;
+		if (grid_.size() != cols * rows)
+		{
+			grid_.assign(cols * rows, 0);
+			previous_.assign(cols * rows, 0);
+			sums_.assign(cols, 0);
+			counts_.assign(cols, 0);
+			primed_ = false;
+		}
+
+		// mean in-band depth of every cell, a row of cells at a time
+		for (int r = 0; r < rows; r++)
+		{
+			std::fill(sums_.begin(), sums_.end(), 0);
+			std::fill(counts_.begin(), counts_.end(), 0);
+			for (int y = r * cellSize; y < (r + 1) * cellSize; y++)
+			{
+				const int16_t* row = depth.depth.data() + y * depth.width;
+				for (int x = 0; x < cols * cellSize; x++)
+				{
+					const int inBand = row[x] > minDist_ && row[x] < maxDist_;
+					sums_[x / cellSize] += inBand * row[x];
+					counts_[x / cellSize] += inBand;
+				}
+			}
+			for (int c = 0; c < cols; c++)
+				grid_[r * cols + c] = counts_[c] > 0 ? sums_[c] / counts_[c] : 0;
+		}
+
+		// sum of absolute differences, and the cells that changed by more than the threshold
+		int changedCells = 0;
+		long long sad = 0;
+		for (int i = 0; i < grid_.size(); i++)
+		{
+			const int d = std::abs(grid_[i] - previous_[i]);
+			sad += d;
+			changedCells += d > cellThreshold_;
+		}
+		sadPerCell_ = (double)sad / grid_.size();
+		grid_.swap(previous_);
+
+		const bool first = !primed_;
+		primed_ = true;
+		return first || changedCells >= minCells_;
+	}
+
+	static double wall_seconds()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static const int cellSize = 8; // depth pixels
+
+	int minDist_{ 0 };
+	int maxDist_{ 10000 };
+	int cellThreshold_{ 100 };
+	int minCells_{ 2 };
+	double idleAfter_{ 30 };
+	double idleInterval_{ 2 };
+
+	std::vector<int> grid_;
+	std::vector<int> previous_;
+	std::vector<int> sums_;
+	std::vector<int> counts_;
+	bool primed_{ false };
+	double sadPerCell_{ 0 };
+
+	bool idle_{ false };
+	bool waking_{ false };
+	double lastMotion_{ 0 };
+	double lastDetection_{ 0 };
+
+	long long detected_{ 0 };
+	long long skipped_{ 0 };
+	long long wakeUps_{ 0 };
+	double wakeLatency_{ 0 };
+	double lastCpu_{ 0 };
+	double lastWall_{ 0 };
+};
+
+#endif // IDLESCHEDULER_HPP
@@ -0,0 +1,123 @@
+#ifndef IMAGEPYRAMID_HPP
+#define IMAGEPYRAMID_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+
+// per-frame image pyramid shared by everything that looks at the colour frame
+// level 0 is the equalized grey frame (or the luma image the colour listener already
+// produced, possibly downscaled), level i is level 0 shrunk by scaleFactor^i.
+// nothing is computed until somebody asks for a level, and the level buffers live for
+// the whole run, so a steady frame size never reallocates them
+class ImagePyramid
+{
+public:
+	explicit ImagePyramid(double scaleFactor = 1.25, int minSize = 30)
+		: scaleFactor_(scaleFactor), minSize_(minSize)
+	{}
+
+	// starts a new frame; request levels before anything is drawn onto the frame
+	void reset(const cv::Mat& colour)
+	{
+		colour_ = colour;
+		if (external_ || colour.cols != size_.width || colour.rows != size_.height || baseScale_ != 1.0)
+			resize_levels(colour.size(), 1.0);
+		external_ = false;
+		std::fill(ready_.begin(), ready_.end(), false);
+	}
+
+	// starts a new frame whose level 0 was already converted and equalized;
+	// 'scale' is its size relative to the frame. colour may be empty (headless)
+	void reset(const cv::Mat& colour, const cv::Mat& grey, double scale)
+	{
+		colour_ = colour;
+		if (grey.cols != size_.width || grey.rows != size_.height || baseScale_ != scale)
+			resize_levels(grey.size(), scale);
+		std::fill(ready_.begin(), ready_.end(), false);
+		external_ = true;
+		// an empty grey frame (or one below minSize) has no levels to fill
+		if (levels_.empty())
+			return;
+		levels_[0] = grey;
+		ready_[0] = true;
+	}
+
+	const cv::Mat& colour() const { return colour_; }
+	int levels() const { return (int)levels_.size(); }
+
+	// full resolution frame size, even when only a downscaled level 0 exists
+	cv::Size frame_size() const { return frameSize_; }
+
+	// how much smaller than the frame a level is, e.g. 0.5 for half size
+	double scale(int level) const { return scales_[level]; }
+
+	const cv::Mat& level(int i)
+	{
+		if (!ready_[i])
+		{
+			if (i == 0)
+			{
+				// grey conversion and equalization into the same buffer
+				cv::cvtColor(colour_, levels_[0], cv::COLOR_BGR2GRAY);
+				cv::equalizeHist(levels_[0], levels_[0]);
+			}
+			else
+			{
+				// built from the next level up, which is itself built on demand
+				cv::resize(level(i - 1), levels_[i], levelSizes_[i], 0, 0, cv::INTER_AREA);
+			}
+			ready_[i] = true;
+		}
+		return levels_[i];
+	}
+
+	// the smallest level that is still at least the requested scale of the frame
+	int level_for_scale(double scale) const
+	{
+		int found = 0;
+		for (int i = 1; i < scales_.size(); i++)
+		{
+			if (scales_[i] + 1e-6 < scale)
+				break;
+			found = i;
+		}
+		return found;
+	}
+
+private:
+	void resize_levels(const cv::Size& size, double baseScale)
+	{
+		size_ = size;
+		baseScale_ = baseScale;
+		frameSize_ = cv::Size(cvRound(size.width / baseScale), cvRound(size.height / baseScale));
+		levels_.clear();
+		levelSizes_.clear();
+		scales_.clear();
+
+		double scale = 1.0;
+		while (cvRound(size.width * scale) >= minSize_ && cvRound(size.height * scale) >= minSize_)
+		{
+			levelSizes_.push_back(cv::Size(cvRound(size.width * scale), cvRound(size.height * scale)));
+			scales_.push_back(scale * baseScale);
+			levels_.push_back(cv::Mat(levelSizes_.back(), CV_8UC1));
+			scale /= scaleFactor_;
+		}
+		ready_.assign(levels_.size(), false);
+	}
+
+	double scaleFactor_;
+	int minSize_;
+
+	cv::Mat colour_;
+	cv::Size size_;		// of level 0
+	cv::Size frameSize_;
+	double baseScale_{ 1.0 };
+	bool external_{ false };	// level 0 shares the caller's luma buffer
+	std::vector<cv::Mat> levels_;
+	std::vector<cv::Size> levelSizes_;
+	std::vector<double> scales_;
+	std::vector<bool> ready_;
+};
+
+#endif // IMAGEPYRAMID_HPP
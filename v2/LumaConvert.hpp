@@ -0,0 +1,93 @@
+#ifndef LUMACONVERT_HPP
+#define LUMACONVERT_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+// sensor rgb888 straight to an equalized 8-bit luma image
+// replaces copying the frame into a BGR Mat and letting opencv convert it to grey.
+// each output row is converted (optionally box-averaged down by 'downscale') and
+// counted into the histogram while it is still in cache; the equalization table is
+// then applied in place. weights are bt.601 in 8-bit fixed point, as opencv uses.
+inline void rgb_to_luma(const uint8_t* rgb, int width, int height, int downscale, bool equalize, cv::Mat& luma)
+{
+	const int outWidth = width / downscale;
+	const int outHeight = height / downscale;
+	luma.create(outHeight, outWidth, CV_8UC1);
+
+	int histogram[256] = { 0 };
+	const int area = downscale * downscale;
+
+	for (int y = 0; y < outHeight; y++)
+	{
+		uint8_t* __restrict dst = luma.ptr<uint8_t>(y);
+
+		if (downscale == 1)
+		{
+			const uint8_t* __restrict src = rgb + y * width * 3;
+			for (int x = 0; x < outWidth; x++)
+			{
+				dst[x] = (uint8_t)((77 * src[3 * x] + 150 * src[3 * x + 1] + 29 * src[3 * x + 2] + 128) >> 8);
+			}
+		}
+		else
+		{
+			for (int x = 0; x < outWidth; x++)
+			{
+				int sum = 0;
+				for (int by = 0; by < downscale; by++)
+				{
+					const uint8_t* __restrict src = rgb + ((y * downscale + by) * width + x * downscale) * 3;
+					for (int bx = 0; bx < downscale; bx++)
+					{
+						sum += 77 * src[3 * bx] + 150 * src[3 * bx + 1] + 29 * src[3 * bx + 2];
+					}
+				}
+				dst[x] = (uint8_t)(((sum + 128) >> 8) / area);
+			}
+		}
+
+		if (equalize)
+		{
+			for (int x = 0; x < outWidth; x++)
+				histogram[dst[x]]++;
+		}
+	}
+
+	if (!equalize)
+		return;
+
+	// same table as cv::equalizeHist: the darkest used level maps to 0
+	int first = 0;
+	while (first < 255 && histogram[first] == 0)
+		first++;
+
+	const int total = outWidth * outHeight;
+	uint8_t lut[256] = { 0 };
+	if (histogram[first] == total)
+	{
+		// flat image
+		for (int i = 0; i < 256; i++)
+			lut[i] = (uint8_t)first;
+	}
+	else
+	{
+		const float scale = 255.f / (total - histogram[first]);
+		int sum = 0;
+		for (int i = first + 1; i < 256; i++)
+		{
+			sum += histogram[i];
+			const int v = cvRound(sum * scale);
+			lut[i] = (uint8_t)(v > 255 ? 255 : v);
+		}
+	}
+
+	for (int y = 0; y < outHeight; y++)
+	{
+		uint8_t* __restrict row = luma.ptr<uint8_t>(y);
+		for (int x = 0; x < outWidth; x++)
+			row[x] = lut[row[x]];
+	}
+}
+
+#endif // LUMACONVERT_HPP
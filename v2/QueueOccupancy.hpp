@@ -0,0 +1,150 @@
+#ifndef QUEUEOCCUPANCY_HPP
+#define QUEUEOCCUPANCY_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "FrameSync.hpp"
+
+// how far back the queue reaches, from the point frame
+// the points between two heights are binned into a floor grid (x, z in mm, camera held
+// level) covering a band along the queue axis, from its head 'from' to 'to'. a cell is
+// occupied when enough points land in it; every point is weighted by its distance
+// squared, so a cell needs about the same surface whether it is near or far. the cost
+// is one pass over the point frame plus one over the grid, whoever is in the queue
+class QueueOccupancy
+{
+public:
+	// 'minPoints': points in a cell to be occupied, as seen from 1 m
+	// 'gap': the longest empty stretch still taken as part of the queue
+	void configure(const cv::Point2f& from, const cv::Point2f& to, float width, float cell,
+		float minY, float maxY, float minPoints, float gap)
+	{
+		cell_ = cell;
+		inverseCell_ = 1.f / cell;
+		minY_ = minY;
+		maxY_ = maxY;
+		minPoints_ = minPoints;
+		gap_ = gap;
+
+		// grid over the bounding box of the band
+		x0_ = std::min(from.x, to.x) - width / 2;
+		z0_ = std::min(from.y, to.y) - width / 2;
+		cols_ = (int)std::ceil((std::fabs(to.x - from.x) + width) / cell);
+		rows_ = (int)std::ceil((std::fabs(to.y - from.y) + width) / cell);
+		weights_.assign(cols_ * rows_ + 1, 0); // the last one collects every point outside
+
+		// slice along the axis of every cell centre, -1 outside the band
+		const float length = std::sqrt((to.x - from.x) * (to.x - from.x) + (to.y - from.y) * (to.y - from.y));
+		const float dx = length > 0 ? (to.x - from.x) / length : 0;
+		const float dz = length > 0 ? (to.y - from.y) / length : 1;
+		slices_ = std::max(1, (int)std::ceil(length / cell));
+		cellSlice_.assign(cols_ * rows_, -1);
+		sliceCells_.assign(slices_, 0);
+		sliceOccupied_.assign(slices_, 0);
+		for (int r = 0; r < rows_; r++)
+		{
+			for (int c = 0; c < cols_; c++)
+			{
+				const float x = x0_ + (c + 0.5f) * cell - from.x;
+				const float z = z0_ + (r + 0.5f) * cell - from.y;
+				const float along = x * dx + z * dz;
+				const float across = x * dz - z * dx;
+				if (along < 0 || along >= length || std::fabs(across) > width / 2)
+					continue;
+				const int s = std::min(slices_ - 1, (int)(along / cell));
+				cellSlice_[r * cols_ + c] = s;
+				sliceCells_[s]++;
+			}
+		}
+		density_.reserve(slices_);
+	}
+
+	bool configured() const { return slices_ > 0 && !cellSlice_.empty(); }
+
+	void update(const std::vector<WorldPoint>& points)
+	{
+		if (!configured() || points.empty())
+			return;
+
+		// points into cells, branch-free: anything outside goes into the spare last cell
+		std::fill(weights_.begin(), weights_.end(), 0.f);
+		const int outside = cols_ * rows_;
+		const int n = (int)points.size();
+		const WorldPoint* p = points.data();
+		float* weights = weights_.data();
+		for (int i = 0; i < n; i++)
+		{
+			const float fx = (p[i].x - x0_) * inverseCell_;
+			const float fz = (p[i].z - z0_) * inverseCell_;
+			const bool inside = p[i].z > 0 && p[i].y >= minY_ && p[i].y <= maxY_ &&
+				fx >= 0 && fx < cols_ && fz >= 0 && fz < rows_;
+			const int cell = inside ? (int)fz * cols_ + (int)fx : outside;
+			weights[cell] += p[i].z * p[i].z * 1e-6f;
+		}
+
+		// occupied cells per slice along the axis
+		std::fill(sliceOccupied_.begin(), sliceOccupied_.end(), 0);
+		for (int c = 0; c < outside; c++)
+		{
+			if (cellSlice_[c] >= 0 && weights[c] >= minPoints_)
+				sliceOccupied_[cellSlice_[c]]++;
+		}
+
+		// from the head back to the last occupied slice before a gap that is too long
+		int last = -1;
+		for (int s = 0; s < slices_; s++)
+		{
+			if (sliceOccupied_[s] > 0)
+				last = s;
+			else if ((s - last) * cell_ > gap_)
+				break;
+		}
+		length_ = (last + 1) * cell_ / 1000.f;
+	}
+
+	// length in metres, and the density of every slice from the head back as 0-9
+	void print()
+	{
+		if (!configured())
+			return;
+
+		density_.clear();
+		for (int s = 0; s < slices_; s++)
+		{
+			const int level = sliceCells_[s] > 0 ? sliceOccupied_[s] * 9 / sliceCells_[s] : 0;
+			density_.push_back((char)('0' + level));
+		}
+		const std::streamsize precision = std::cout.precision();
+		std::cout << "Queue length: " << std::fixed << std::setprecision(1) << length_ << " m, density: "
+			<< density_ << std::defaultfloat << std::setprecision(precision) << std::endl;
+	}
+
+	float length() const { return length_; }
+
+private:
+	float cell_{ 100 };
+	float inverseCell_{ 0.01f };
+	float minY_{ 0 };
+	float maxY_{ 0 };
+	float minPoints_{ 0 };
+	float gap_{ 0 };
+	float x0_{ 0 };
+	float z0_{ 0 };
+	int cols_{ 0 };
+	int rows_{ 0 };
+	int slices_{ 0 };
+
+	std::vector<float> weights_;
+	std::vector<int> cellSlice_;
+	std::vector<int> sliceCells_;
+	std::vector<int> sliceOccupied_;
+	std::string density_;
+	float length_{ 0 };
+};
+
+#endif // QUEUEOCCUPANCY_HPP
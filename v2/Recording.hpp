@@ -0,0 +1,161 @@
+#ifndef RECORDING_HPP
+#define RECORDING_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// recording file (.rec), as written by the flight recorder:
+// the 8 byte magic below, then records of a RecordHeader followed by 'size' bytes
+//   Colour - the colour (or grey) frame as jpeg
+//   Depth  - uint16 width, uint16 height, then every pixel as the zigzag varint of its
+//            difference to the previous pixel, row by row
+//   Event  - text of a pipeline event, not zero terminated
+// times are microseconds of the steady clock, only differences between them mean anything
+enum class RecordType : uint32_t
+{
+	Colour = 1,
+	Depth = 2,
+	Event = 3
+};
+
+struct RecordHeader
+{
+	uint32_t type;
+	uint32_t size; // payload bytes
+	int64_t time; // us
+	int64_t index; // sensor frame index, -1 for events
+};
+static_assert(sizeof(RecordHeader) == 24, "RecordHeader is written as is");
+
+const char recordingMagic[8] = { 'D', 'S', 'R', 'E', 'C', '0', '0', '1' };
+
+
+inline void encode_depth(const int16_t* depth, int width, int height, std::vector<uint8_t>& out)
+{
+	out.clear();
+	out.push_back((uint8_t)(width & 0xff));
+	out.push_back((uint8_t)(width >> 8));
+	out.push_back((uint8_t)(height & 0xff));
+	out.push_back((uint8_t)(height >> 8));
+
+	int previous = 0;
+	for (int i = 0; i < width * height; i++)
+	{
+		const int d = depth[i] - previous;
+		previous = depth[i];
+		uint32_t u = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+		while (u >= 0x80)
+		{
+			out.push_back((uint8_t)(u | 0x80));
+			u >>= 7;
+		}
+		out.push_back((uint8_t)u);
+	}
+}
+
+inline bool decode_depth(const uint8_t* data, size_t size, std::vector<int16_t>& depth, int& width, int& height)
+{
+	if (size < 4)
+		return false;
+	width = data[0] | (data[1] << 8);
+	height = data[2] | (data[3] << 8);
+	depth.resize(width * height);
+
+	size_t p = 4;
+	int previous = 0;
+	for (int i = 0; i < width * height; i++)
+	{
+		uint32_t u = 0;
+		for (int shift = 0; ; shift += 7)
+		{
+			if (p >= size || shift > 28)
+				return false;
+			const uint8_t b = data[p++];
+			u |= (uint32_t)(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				break;
+		}
+		const int d = (int)(u >> 1) ^ -(int)(u & 1);
+		previous += d;
+		depth[i] = (int16_t)previous;
+	}
+	return true;
+}
+
+inline void write_record(std::ostream& out, RecordType type, int64_t time, int64_t index, const uint8_t* data, size_t size)
+{
+	RecordHeader header;
+	header.type = (uint32_t)type;
+	header.size = (uint32_t)size;
+	header.time = time;
+	header.index = index;
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)data, size);
+}
+
+
+// reads a recording back, one record at a time
+class RecordingReader
+{
+public:
+	bool open(const std::string& path)
+	{
+		file_.open(path, std::ios::binary);
+		char magic[sizeof(recordingMagic)];
+		return file_.read(magic, sizeof(magic)) && std::memcmp(magic, recordingMagic, sizeof(magic)) == 0;
+	}
+
+	// false at the end of the file or on a truncated record
+	bool next(RecordHeader& header, std::vector<uint8_t>& payload)
+	{
+		if (!file_.read((char*)&header, sizeof(header)))
+			return false;
+		payload.resize(header.size);
+		return header.size == 0 || (bool)file_.read((char*)payload.data(), header.size);
+	}
+
+	// the next colour frame and the depth frame written after it, skipping events and
+	// anything that does not decode; false at the end of the file
+	bool next_pair(cv::Mat& image, RecordHeader& imageHeader, std::vector<int16_t>& depth, int& width, int& height, RecordHeader& depthHeader)
+	{
+		bool haveImage = false;
+		while (next(header_, payload_))
+		{
+			if (header_.type == (uint32_t)RecordType::Colour)
+			{
+				haveImage = decode_colour(payload_, image);
+				imageHeader = header_;
+			}
+			else if (header_.type == (uint32_t)RecordType::Depth && haveImage &&
+				decode_depth(payload_.data(), payload_.size(), depth, width, height))
+			{
+				depthHeader = header_;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// bytes read so far, for progress reports
+	long long position()
+	{
+		return (long long)file_.tellg();
+	}
+
+	static bool decode_colour(const std::vector<uint8_t>& payload, cv::Mat& image)
+	{
+		image = cv::imdecode(payload, cv::IMREAD_UNCHANGED);
+		return !image.empty();
+	}
+
+private:
+	std::ifstream file_;
+	RecordHeader header_;
+	std::vector<uint8_t> payload_;
+};
+
+#endif // RECORDING_HPP
@@ -0,0 +1,372 @@
+#ifndef SHAREDFRAMES_HPP
+#define SHAREDFRAMES_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// frames and tracks published to other local processes through shared memory
+// the region is a header followed by a ring of fixed-size slots, each holding one
+// colour (or grey) frame, its depth frame and the tracks at that frame. the one
+// writer never waits for anybody: every slot has a sequence number that is odd while
+// the slot is being written, so a reader looks at a slot in place and checks the
+// sequence again afterwards (still_valid) to know it was not overwritten meanwhile.
+// this header is all a consumer needs - SharedFrameReader maps the region read-only
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the sequence numbers live in shared memory");
+
+const char sharedFramesMagic[8] = { 'D', 'S', 'S', 'H', 'M', '0', '0', '1' };
+
+// one face, in colour pixels
+struct SharedTrack
+{
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+	int32_t distance; // mm, 0 for a hole
+	int32_t state; // 0 verifying, 1 tracking
+	float worldX; // mm, camera space, all 0 when not known
+	float worldY;
+	float worldZ;
+};
+
+// what a reader gets: pointers into the slot, valid until the writer comes round again
+struct SharedFrameView
+{
+	uint64_t sequence{ 0 }; // frames published before this one, plus one
+	int64_t time{ 0 }; // us of the steady clock of the writer
+	int64_t index{ 0 }; // sensor frame index of the colour frame
+	int colourWidth{ 0 };
+	int colourHeight{ 0 };
+	int colourChannels{ 0 }; // 3 bgr, 1 grey, 0 none
+	const uint8_t* colour{ nullptr };
+	int depthWidth{ 0 };
+	int depthHeight{ 0 };
+	const int16_t* depth{ nullptr }; // mm
+	int trackCount{ 0 };
+	const SharedTrack* tracks{ nullptr };
+	int count{ 0 }; // people counted so far
+};
+
+
+struct SharedRegionHeader
+{
+	char magic[8];
+	uint32_t slots;
+	uint32_t slotBytes;
+	uint32_t colourBytes; // capacity of every slot
+	uint32_t depthBytes;
+	uint32_t maxTracks;
+	uint32_t reserved;
+	std::atomic<uint64_t> published; // frames so far; the newest is in slot (published - 1) % slots
+};
+
+struct SharedSlotHeader
+{
+	std::atomic<uint64_t> sequence; // 2n + 1 while frame n is written, 2n + 2 once done
+	int64_t time;
+	int64_t index;
+	int32_t colourWidth;
+	int32_t colourHeight;
+	int32_t colourChannels;
+	int32_t depthWidth;
+	int32_t depthHeight;
+	int32_t trackCount;
+	int32_t count;
+	int32_t reserved;
+};
+
+// every part of a slot starts on a cache line
+inline size_t shared_aligned(size_t bytes)
+{
+	return (bytes + 63) / 64 * 64;
+}
+
+// a named shared memory region, created by the writer or opened read-only
+class SharedMapping
+{
+public:
+	~SharedMapping() { close(); }
+
+	bool create(const std::string& name, size_t size)
+	{
+		size_ = size;
+#ifdef _WIN32
+		handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xffffffff), ("Local\\" + name).c_str());
+		if (!handle_)
+			return false;
+		data_ = (uint8_t*)MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+		name_ = "/" + name;
+		const int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+		if (fd < 0)
+			return false;
+		if (ftruncate(fd, (off_t)size) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		data_ = data == MAP_FAILED ? nullptr : (uint8_t*)data;
+		owner_ = true;
+#endif
+		return data_ != nullptr;
+	}
+
+	bool open(const std::string& name)
+	{
+#ifdef _WIN32
+		handle_ = OpenFileMappingA(FILE_MAP_READ, FALSE, ("Local\\" + name).c_str());
+		if (!handle_)
+			return false;
+		data_ = (uint8_t*)MapViewOfFile(handle_, FILE_MAP_READ, 0, 0, 0);
+		MEMORY_BASIC_INFORMATION info;
+		size_ = data_ && VirtualQuery(data_, &info, sizeof(info)) ? info.RegionSize : 0;
+#else
+		const int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		size_ = (size_t)st.st_size;
+		void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		data_ = data == MAP_FAILED ? nullptr : (uint8_t*)data;
+#endif
+		return data_ != nullptr;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data_)
+			UnmapViewOfFile(data_);
+		if (handle_)
+			CloseHandle(handle_);
+		handle_ = NULL;
+#else
+		if (data_)
+			munmap(data_, size_);
+		if (owner_)
+			shm_unlink(name_.c_str());
+		owner_ = false;
+#endif
+		data_ = nullptr;
+	}
+
+	uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	uint8_t* data_{ nullptr };
+	size_t size_{ 0 };
+#ifdef _WIN32
+	HANDLE handle_{ NULL };
+#else
+	std::string name_;
+	bool owner_{ false };
+#endif
+};
+
+
+// the writer side, in the process that owns the sensor
+class SharedFramePublisher
+{
+public:
+	// slots for frames up to the given sizes; false when the region could not be created
+	bool start(const std::string& name, int slots, int maxWidth, int maxHeight, int maxDepthWidth, int maxDepthHeight, int maxTracks)
+	{
+		colourBytes_ = shared_aligned((size_t)maxWidth * maxHeight * 3);
+		depthBytes_ = shared_aligned((size_t)maxDepthWidth * maxDepthHeight * sizeof(int16_t));
+		maxTracks_ = maxTracks;
+		slotBytes_ = shared_aligned(sizeof(SharedSlotHeader)) + colourBytes_ + depthBytes_ + shared_aligned(maxTracks * sizeof(SharedTrack));
+		slots_ = slots;
+		if (!mapping_.create(name, shared_aligned(sizeof(SharedRegionHeader)) + slotBytes_ * slots))
+		{
+			std::cout << "Shared memory: unable to create " << name << std::endl;
+			return false;
+		}
+
+		SharedRegionHeader* header = new (mapping_.data()) SharedRegionHeader();
+		header->slots = slots;
+		header->slotBytes = (uint32_t)slotBytes_;
+		header->colourBytes = (uint32_t)colourBytes_;
+		header->depthBytes = (uint32_t)depthBytes_;
+		header->maxTracks = maxTracks;
+		header->published.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < slots; i++)
+			new (slot(i)) SharedSlotHeader();
+		// readers check the magic last, so it goes in once everything else is set up
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(header->magic, sharedFramesMagic, sizeof(sharedFramesMagic));
+		return true;
+	}
+
+	bool running() const { return mapping_.data() != nullptr; }
+
+	// 'image' is 8 bit bgr or grey; anything bigger than the slots is left out
+	void publish(const uint8_t* image, int width, int height, int channels, const int16_t* depth, int depthWidth, int depthHeight,
+		int64_t time, int64_t index, const SharedTrack* tracks, int trackCount, int count)
+	{
+		if (!running())
+			return;
+
+		SharedRegionHeader* header = (SharedRegionHeader*)mapping_.data();
+		const uint64_t n = header->published.load(std::memory_order_relaxed);
+		uint8_t* base = slot((int)(n % slots_));
+		SharedSlotHeader* s = (SharedSlotHeader*)base;
+
+		s->sequence.store(2 * n + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		const size_t colourSize = (size_t)width * height * channels;
+		const size_t depthSize = (size_t)depthWidth * depthHeight * sizeof(int16_t);
+		const bool colourFits = image && colourSize <= colourBytes_;
+		const bool depthFits = depth && depthSize <= depthBytes_;
+		oversize_ += (image && !colourFits) || (depth && !depthFits);
+		trackCount = trackCount < maxTracks_ ? trackCount : maxTracks_;
+
+		uint8_t* data = base + shared_aligned(sizeof(SharedSlotHeader));
+		if (colourFits)
+			std::memcpy(data, image, colourSize);
+		if (depthFits)
+			std::memcpy(data + colourBytes_, depth, depthSize);
+		std::memcpy(data + colourBytes_ + depthBytes_, tracks, trackCount * sizeof(SharedTrack));
+
+		s->time = time;
+		s->index = index;
+		s->colourWidth = colourFits ? width : 0;
+		s->colourHeight = colourFits ? height : 0;
+		s->colourChannels = colourFits ? channels : 0;
+		s->depthWidth = depthFits ? depthWidth : 0;
+		s->depthHeight = depthFits ? depthHeight : 0;
+		s->trackCount = trackCount;
+		s->count = count;
+
+		s->sequence.store(2 * n + 2, std::memory_order_release);
+		header->published.store(n + 1, std::memory_order_release);
+		published_++;
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::cout << "Shared memory: frames published: " << published_ << ", too big for a slot: " << oversize_ << std::endl;
+		published_ = 0;
+		oversize_ = 0;
+	}
+
+private:
+	uint8_t* slot(int i)
+	{
+		return mapping_.data() + shared_aligned(sizeof(SharedRegionHeader)) + slotBytes_ * i;
+	}
+
+	SharedMapping mapping_;
+	size_t colourBytes_{ 0 };
+	size_t depthBytes_{ 0 };
+	size_t slotBytes_{ 0 };
+	int slots_{ 0 };
+	int maxTracks_{ 0 };
+
+	long long published_{ 0 };
+	long long oversize_{ 0 };
+};
+
+
+// the reader side, for consumers in other processes
+//   SharedFrameReader reader;
+//   reader.open("depthsensor");
+//   SharedFrameView view;
+//   if (reader.latest(view)) { ...use view in place...; if (!reader.still_valid(view)) { drop what came of it } }
+class SharedFrameReader
+{
+public:
+	// false while the writer has not set the region up (yet)
+	bool open(const std::string& name)
+	{
+		if (!mapping_.open(name) || mapping_.size() < sizeof(SharedRegionHeader))
+			return false;
+		header_ = (const SharedRegionHeader*)mapping_.data();
+		if (std::memcmp(header_->magic, sharedFramesMagic, sizeof(sharedFramesMagic)) != 0)
+			return false;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return mapping_.size() >= shared_aligned(sizeof(SharedRegionHeader)) + (size_t)header_->slotBytes * header_->slots;
+	}
+
+	// frames published so far, to tell whether there is a new one
+	uint64_t published() const
+	{
+		return header_ ? header_->published.load(std::memory_order_acquire) : 0;
+	}
+
+	// the newest frame; false when there is none or the writer was in the middle of it
+	bool latest(SharedFrameView& view) const
+	{
+		const uint64_t n = published();
+		if (n == 0)
+			return false;
+
+		const uint8_t* base = slot((int)((n - 1) % header_->slots));
+		const SharedSlotHeader* s = (const SharedSlotHeader*)base;
+		const uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+		if (sequence & 1)
+			return false;
+
+		const uint8_t* data = base + shared_aligned(sizeof(SharedSlotHeader));
+		view.sequence = sequence / 2;
+		view.time = s->time;
+		view.index = s->index;
+		view.colourWidth = s->colourWidth;
+		view.colourHeight = s->colourHeight;
+		view.colourChannels = s->colourChannels;
+		view.colour = data;
+		view.depthWidth = s->depthWidth;
+		view.depthHeight = s->depthHeight;
+		view.depth = (const int16_t*)(data + header_->colourBytes);
+		view.trackCount = s->trackCount;
+		view.tracks = (const SharedTrack*)(data + header_->colourBytes + header_->depthBytes);
+		view.count = s->count;
+		return still_valid(view);
+	}
+
+	// whether the slot 'view' points into still holds that frame; call it after reading
+	bool still_valid(const SharedFrameView& view) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const SharedSlotHeader* s = (const SharedSlotHeader*)slot((int)((view.sequence - 1) % header_->slots));
+		return s->sequence.load(std::memory_order_relaxed) == view.sequence * 2;
+	}
+
+private:
+	const uint8_t* slot(int i) const
+	{
+		return mapping_.data() + shared_aligned(sizeof(SharedRegionHeader)) + (size_t)header_->slotBytes * i;
+	}
+
+	SharedMapping mapping_;
+	const SharedRegionHeader* header_{ nullptr };
+};
+
+#endif // SHAREDFRAMES_HPP
@@ -0,0 +1,172 @@
+#ifndef SNAPSHOTWRITER_HPP
+#define SNAPSHOTWRITER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Tracing.hpp"
+
+// face snapshots encoded and written to disk off the detection thread
+// a crop is deep-copied into one of a fixed set of frame-sized buffers (allocated
+// once, on first use) and queued for a small pool of workers. when every buffer is
+// still waiting or being written the snapshot is dropped, so a slow disk never holds
+// up a frame
+class SnapshotWriter
+{
+public:
+	~SnapshotWriter() { stop(); }
+
+	// 'format' is the file extension, which picks the encoder ("jpg", "png")
+	void start(int workers, int capacity, const std::string& directory, const std::string& format)
+	{
+		if (!threads_.empty() || workers < 1 || capacity < 1)
+			return;
+
+		directory_ = directory;
+		format_ = format;
+		buffers_.assign(capacity, Buffer());
+		free_.clear();
+		for (int i = capacity - 1; i >= 0; i--)
+			free_.push_back(i);
+		queue_.assign(capacity, 0);
+		head_ = 0;
+		count_ = 0;
+		running_ = true;
+		for (int i = 0; i < workers; i++)
+			threads_.emplace_back(&SnapshotWriter::run, this);
+	}
+
+	// writes what is still queued, then joins the workers
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+		}
+		wake_.notify_all();
+		for (int i = 0; i < threads_.size(); i++)
+			threads_[i].join();
+		threads_.clear();
+	}
+
+	// false when it was dropped; 'stamp' goes into the file name
+	bool submit(const cv::Mat& image, const cv::Rect& r, long long stamp)
+	{
+		const cv::Rect box = r & cv::Rect(0, 0, image.cols, image.rows);
+		if (threads_.empty() || box.area() == 0)
+			return false;
+
+		int slot;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (free_.empty())
+			{
+				dropped_++;
+				return false;
+			}
+			slot = free_.back();
+			free_.pop_back();
+		}
+
+		// nobody else touches a buffer between taking it off the free list and queueing it
+		Buffer& buffer = buffers_[slot];
+		buffer.image.create(image.size(), image.type());
+		cv::Mat crop = buffer.image(cv::Rect(0, 0, box.width, box.height));
+		image(box).copyTo(crop);
+		buffer.size = box.size();
+		buffer.stamp = stamp;
+		buffer.sequence = sequence_++;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			queue_[(head_ + count_) % queue_.size()] = slot;
+			count_++;
+		}
+		wake_.notify_one();
+		return true;
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::cout << "Snapshots written: " << written_
+			<< ", dropped: " << dropped_
+			<< ", failed: " << failed_ << std::endl;
+		written_ = 0;
+		dropped_ = 0;
+		failed_ = 0;
+	}
+
+private:
+	struct Buffer
+	{
+		cv::Mat image;
+		cv::Size size;
+		long long stamp{ 0 };
+		long long sequence{ 0 };
+	};
+
+	void run()
+	{
+		tracer().name_thread("snapshot writer");
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			wake_.wait(lock, [this] { return count_ > 0 || !running_; });
+			if (count_ == 0)
+				return;
+
+			const int slot = queue_[head_];
+			head_ = (head_ + 1) % queue_.size();
+			count_--;
+			lock.unlock();
+
+			const Buffer& buffer = buffers_[slot];
+			const std::string path = directory_ + "/face_" + std::to_string(buffer.stamp) + "_" +
+				std::to_string(buffer.sequence) + "." + format_;
+			bool ok = false;
+			TraceSpan span("snapshot write");
+			try
+			{
+				ok = cv::imwrite(path, buffer.image(cv::Rect(0, 0, buffer.size.width, buffer.size.height)));
+			}
+			catch (const cv::Exception&)
+			{
+				// unknown format or unwritable path - counted as failed
+			}
+
+			span.end();
+			lock.lock();
+			free_.push_back(slot);
+			if (ok)
+				written_++;
+			else
+				failed_++;
+		}
+	}
+
+	std::string directory_;
+	std::string format_;
+	std::vector<Buffer> buffers_;
+	std::vector<int> free_; // buffers neither queued nor being written
+	std::vector<int> queue_; // ring of queued buffers, never fuller than the buffer count
+	int head_{ 0 };
+	int count_{ 0 };
+	bool running_{ false };
+	long long sequence_{ 0 };
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::vector<std::thread> threads_;
+
+	long long written_{ 0 };
+	long long dropped_{ 0 };
+	long long failed_{ 0 };
+};
+
+#endif // SNAPSHOTWRITER_HPP
@@ -0,0 +1,254 @@
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// begin/end spans of the pipeline stages, written out as chrome trace-event json
+// (chrome://tracing or ui.perfetto.dev). every thread records into its own buffer of
+// fixed capacity, allocated on its first span: only that thread writes it, and it
+// publishes each span by bumping the buffer's count, so recording takes no lock.
+// the buffer is a ring - once full, every span overwrites the oldest one, so what is
+// written is always the most recent stretch. buffers outlive their threads, so write()
+// can be called at any time from any thread and writes what is held, oldest first
+class Tracer
+{
+public:
+	typedef std::chrono::steady_clock ClockType;
+
+	struct Span
+	{
+		const char* name; // a literal, only the pointer is kept
+		long long frame; // -1 when the span is not about one frame
+		int64_t begin; // us since start()
+		int64_t end;
+	};
+
+	void start(int capacity)
+	{
+		capacity_ = capacity > 0 ? capacity : 1;
+		origin_ = ClockType::now();
+		enabled_ = true;
+	}
+
+	bool enabled() const { return enabled_; }
+
+	int64_t micros() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(ClockType::now() - origin_).count();
+	}
+
+	void record(const char* name, long long frame, int64_t begin, int64_t end)
+	{
+		ThreadBuffer& buffer = thread_buffer();
+		const long long n = buffer.count.load(std::memory_order_relaxed);
+		if (n >= capacity_)
+			buffer.overwritten.fetch_add(1, std::memory_order_relaxed);
+		// announced before the slot is touched, so write() can tell it is being overwritten
+		buffer.begun.store(n + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		Span& span = buffer.spans[n % capacity_];
+		span.name = name;
+		span.frame = frame;
+		span.begin = begin;
+		span.end = end;
+		buffer.count.store(n + 1, std::memory_order_release);
+	}
+
+	// name of the calling thread in the trace
+	void name_thread(const char* name)
+	{
+		if (enabled_)
+			thread_buffer().name.store(name, std::memory_order_release);
+	}
+
+	// the frame spans of the calling thread are about from now on
+	void set_frame(long long frame)
+	{
+		if (enabled_)
+			thread_buffer().frame = frame;
+	}
+
+	long long frame()
+	{
+		return thread_buffer().frame;
+	}
+
+	bool write(const std::string& path)
+	{
+		std::ofstream out(path);
+		if (!out)
+		{
+			std::cout << "Trace: unable to write " << path << std::endl;
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		long long spans = 0;
+		for (int t = 0; t < buffers_.size(); t++)
+		{
+			const ThreadBuffer& buffer = *buffers_[t];
+			const char* name = buffer.name.load(std::memory_order_acquire);
+			out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer.tid
+				<< ",\"args\":{\"name\":\"" << (name ? name : "thread") << "\"}}";
+			first = false;
+
+			// copied first: the thread may go on overwriting the oldest ones meanwhile, and
+			// those it has started on are left out
+			const long long n = buffer.count.load(std::memory_order_acquire);
+			const long long from = n > capacity_ ? n - capacity_ : 0;
+			copied_.clear();
+			for (long long i = from; i < n; i++)
+				copied_.push_back(buffer.spans[i % capacity_]);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const long long reached = buffer.begun.load(std::memory_order_relaxed) - capacity_;
+			const long long skip = std::min(std::max(reached - from, 0LL), (long long)copied_.size());
+
+			for (long long i = skip; i < (long long)copied_.size(); i++)
+			{
+				const Span& s = copied_[i];
+				out << ",\n{\"ph\":\"X\",\"name\":\"" << s.name << "\",\"pid\":1,\"tid\":" << buffer.tid
+					<< ",\"ts\":" << s.begin << ",\"dur\":" << s.end - s.begin;
+				if (s.frame >= 0)
+					out << ",\"args\":{\"frame\":" << s.frame << "}";
+				out << "}";
+			}
+			spans += copied_.size() - skip;
+		}
+		out << "\n]}\n";
+		std::cout << "Trace: " << spans << " spans of " << buffers_.size() << " threads written to " << path << std::endl;
+		return (bool)out;
+	}
+
+	// figures since the previous report
+	void print_and_reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		long long spans = 0;
+		long long overwritten = 0;
+		for (int t = 0; t < buffers_.size(); t++)
+		{
+			const long long n = buffers_[t]->count.load(std::memory_order_relaxed);
+			spans += n < capacity_ ? n : capacity_;
+			overwritten += buffers_[t]->overwritten.exchange(0, std::memory_order_relaxed);
+		}
+		std::cout << "Trace: " << spans << " spans held, " << buffers_.size() << " threads, overwritten: " << overwritten << std::endl;
+	}
+
+private:
+	struct ThreadBuffer
+	{
+		std::vector<Span> spans; // ring, span i of the thread at i % capacity
+		std::atomic<long long> count{ 0 }; // spans ever recorded
+		std::atomic<long long> begun{ 0 }; // count, or one more while a span is written
+		std::atomic<long long> overwritten{ 0 }; // since the last report
+		std::atomic<const char*> name{ nullptr };
+		int tid{ 0 };
+		long long frame{ -1 };
+	};
+
+	// there is only the one tracer, so one buffer pointer per thread will do
+	ThreadBuffer& thread_buffer()
+	{
+		static thread_local ThreadBuffer* buffer = nullptr;
+		if (!buffer)
+		{
+			std::unique_ptr<ThreadBuffer> created(new ThreadBuffer());
+			created->spans.resize(capacity_);
+			std::lock_guard<std::mutex> lock(mutex_);
+			created->tid = (int)buffers_.size() + 1;
+			buffer = created.get();
+			buffers_.push_back(std::move(created));
+		}
+		return *buffer;
+	}
+
+	bool enabled_{ false };
+	int capacity_{ 0 };
+	ClockType::time_point origin_;
+
+	std::mutex mutex_; // only for registering threads and reading
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+	std::vector<Span> copied_; // one thread's spans while they are written
+};
+
+// the one tracer of the process, so every module can record into it
+inline Tracer& tracer()
+{
+	static Tracer instance;
+	return instance;
+}
+
+
+// a span from construction to end() or destruction; nothing at all while tracing is off
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char* name)
+		: name_(tracer().enabled() ? name : nullptr)
+	{
+		if (name_)
+			begin_ = tracer().micros();
+	}
+
+	~TraceSpan() { end(); }
+
+	void end()
+	{
+		if (!name_)
+			return;
+		tracer().record(name_, tracer().frame(), begin_, tracer().micros());
+		name_ = nullptr;
+	}
+
+private:
+	const char* name_;
+	int64_t begin_{ 0 };
+};
+
+
+// a span measured now and recorded later, only if it turns out to belong to a frame -
+// a pass of the main loop is only worth keeping when it processed one
+class PendingSpan
+{
+public:
+	explicit PendingSpan(const char* name) : name_(name) {}
+
+	void begin()
+	{
+		if (tracer().enabled())
+			begin_ = tracer().micros();
+	}
+
+	void end()
+	{
+		if (tracer().enabled())
+			end_ = tracer().micros();
+	}
+
+	// records the last measurement as a span of 'frame', once
+	void record(long long frame)
+	{
+		if (!tracer().enabled() || end_ < begin_)
+			return;
+		tracer().record(name_, frame, begin_, end_);
+		end_ = -1;
+	}
+
+private:
+	const char* name_;
+	int64_t begin_{ 0 };
+	int64_t end_{ -1 };
+};
+
+#endif // TRACING_HPP
@@ -0,0 +1,170 @@
+#ifndef TRACKFILTER_HPP
+#define TRACKFILTER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+
+// constant-velocity kalman filters for all tracks, stored one array per value
+// every tracked box is five independent filters - centre x, centre y, width, height
+// (colour px) and distance (mm) - each with a position, a velocity and a 2x2
+// covariance. prediction walks each array straight through for all tracks at once.
+// index i is the same track as index i of the faces_tracking* vectors
+class TrackFilters
+{
+public:
+	static const int dims = 5;
+	enum { CentreX, CentreY, Width, Height, Distance };
+
+	// noise as standard deviations: 'process' in px/s^2 (mm/s^2 for distance), 'measurement' in px (mm)
+	void configure(float process, float measurement, float depthProcess, float depthMeasurement)
+	{
+		for (int d = 0; d < dims; d++)
+		{
+			q_[d] = d == Distance ? depthProcess * depthProcess : process * process;
+			r_[d] = d == Distance ? depthMeasurement * depthMeasurement : measurement * measurement;
+		}
+	}
+
+	void reserve(int n)
+	{
+		for (int d = 0; d < dims; d++)
+		{
+			state_[d].pos.reserve(n);
+			state_[d].vel.reserve(n);
+			state_[d].p00.reserve(n);
+			state_[d].p01.reserve(n);
+			state_[d].p11.reserve(n);
+		}
+		hasDistance_.reserve(n);
+	}
+
+	int size() const { return (int)hasDistance_.size(); }
+
+	// a new track at rest; distance 0 is a hole in the depth frame
+	void push(const cv::Rect& r, int distance)
+	{
+		const float values[dims] = { r.x + r.width * 0.5f, r.y + r.height * 0.5f, (float)r.width, (float)r.height, (float)distance };
+		for (int d = 0; d < dims; d++)
+		{
+			state_[d].pos.push_back(values[d]);
+			state_[d].vel.push_back(0);
+			state_[d].p00.push_back(r_[d]);
+			state_[d].p01.push_back(0);
+			state_[d].p11.push_back(initial_velocity(d));
+		}
+		hasDistance_.push_back(distance > 0);
+	}
+
+	void erase(int i)
+	{
+		for (int d = 0; d < dims; d++)
+		{
+			state_[d].pos.erase(state_[d].pos.begin() + i);
+			state_[d].vel.erase(state_[d].vel.begin() + i);
+			state_[d].p00.erase(state_[d].p00.begin() + i);
+			state_[d].p01.erase(state_[d].p01.begin() + i);
+			state_[d].p11.erase(state_[d].p11.begin() + i);
+		}
+		hasDistance_.erase(hasDistance_.begin() + i);
+	}
+
+	// moves every track 'dt' seconds ahead
+	void predict(double dt)
+	{
+		const int n = size();
+		const float t = (float)dt;
+		for (int d = 0; d < dims; d++)
+		{
+			float* pos = state_[d].pos.data();
+			const float* vel = state_[d].vel.data();
+			float* p00 = state_[d].p00.data();
+			float* p01 = state_[d].p01.data();
+			float* p11 = state_[d].p11.data();
+			// white noise acceleration
+			const float q00 = q_[d] * t * t * t * t / 4;
+			const float q01 = q_[d] * t * t * t / 2;
+			const float q11 = q_[d] * t * t;
+			for (int i = 0; i < n; i++)
+			{
+				pos[i] += vel[i] * t;
+				p00[i] += t * (2 * p01[i] + t * p11[i]) + q00;
+				p01[i] += t * p11[i] + q01;
+				p11[i] += q11;
+			}
+		}
+	}
+
+	// a detection of track i; distance 0 leaves the distance filter alone
+	void correct(int i, const cv::Rect& r, int distance)
+	{
+		const float values[dims] = { r.x + r.width * 0.5f, r.y + r.height * 0.5f, (float)r.width, (float)r.height, (float)distance };
+		for (int d = 0; d < dims; d++)
+		{
+			if (d == Distance && distance <= 0)
+				continue;
+			State& s = state_[d];
+			if (d == Distance && !hasDistance_[i])
+			{
+				// first distance seen for this track
+				s.pos[i] = values[d];
+				s.vel[i] = 0;
+				s.p00[i] = r_[d];
+				s.p01[i] = 0;
+				s.p11[i] = initial_velocity(d);
+				hasDistance_[i] = true;
+				continue;
+			}
+
+			const float inverse = 1.f / (s.p00[i] + r_[d]); // 1 / innovation variance
+			const float k0 = s.p00[i] * inverse;
+			const float k1 = s.p01[i] * inverse;
+			const float innovation = values[d] - s.pos[i];
+			s.pos[i] += k0 * innovation;
+			s.vel[i] += k1 * innovation;
+			s.p11[i] -= k1 * s.p01[i];
+			s.p00[i] *= 1 - k0;
+			s.p01[i] *= 1 - k0;
+		}
+	}
+
+	// where track i is expected to be
+	cv::Rect box(int i) const
+	{
+		const float w = state_[Width].pos[i] > 1 ? state_[Width].pos[i] : 1;
+		const float h = state_[Height].pos[i] > 1 ? state_[Height].pos[i] : 1;
+		return cv::Rect(cvRound(state_[CentreX].pos[i] - w / 2), cvRound(state_[CentreY].pos[i] - h / 2), cvRound(w), cvRound(h));
+	}
+
+	// expected distance in mm, 0 when no distance has been measured yet
+	int distance(int i) const
+	{
+		return hasDistance_[i] ? cvRound(state_[Distance].pos[i]) : 0;
+	}
+
+	// speed uncertainty of a new track
+	static constexpr float initialVelocity = 100.f; // px/s
+	static constexpr float initialDepthVelocity = 500.f; // mm/s
+
+private:
+	static float initial_velocity(int d)
+	{
+		return d == Distance ? initialDepthVelocity * initialDepthVelocity : initialVelocity * initialVelocity;
+	}
+
+	struct State
+	{
+		std::vector<float> pos;
+		std::vector<float> vel;
+		std::vector<float> p00; // covariance [p00 p01; p01 p11]
+		std::vector<float> p01;
+		std::vector<float> p11;
+	};
+
+	State state_[dims];
+	std::vector<bool> hasDistance_;
+	float q_[dims]{};
+	float r_[dims]{};
+};
+
+#endif // TRACKFILTER_HPP
@@ -0,0 +1,65 @@
+#ifndef WORLDTRACK_HPP
+#define WORLDTRACK_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include "FrameSync.hpp"
+
+// world position of a face 'r' (colour pixels): the mean of the valid points in a
+// 3x3 depth pixel window at its centre. false when the window is all holes
+inline bool face_world(const DepthSlot& depth, const cv::Rect& r, WorldPoint& world)
+{
+	world = WorldPoint();
+	if (depth.points.empty())
+		return false;
+
+	// depth frame is 4x smaller than the colour frame
+	const int cx = (r.x + r.width / 2) / 4;
+	const int cy = (r.y + r.height / 2) / 4;
+	int count = 0;
+	for (int y = cy - 1; y <= cy + 1; y++)
+	{
+		for (int x = cx - 1; x <= cx + 1; x++)
+		{
+			if (x < 0 || y < 0 || x >= depth.width || y >= depth.height)
+				continue;
+			const WorldPoint& p = depth.points[y * depth.width + x];
+			if (p.z <= 0)
+				continue;
+			world.x += p.x;
+			world.y += p.y;
+			world.z += p.z;
+			count++;
+		}
+	}
+	if (count == 0)
+		return false;
+
+	world.x /= count;
+	world.y /= count;
+	world.z /= count;
+	return true;
+}
+
+inline float world_distance(const WorldPoint& a, const WorldPoint& b)
+{
+	const float dx = a.x - b.x;
+	const float dy = a.y - b.y;
+	const float dz = a.z - b.z;
+	return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// how far a person can have moved in 'dt' seconds: walking speed limit plus the
+// noise of the depth measurement itself
+struct WorldReach
+{
+	float maxSpeed{ 3000 }; // mm/s
+	float slack{ 300 }; // mm
+
+	float operator()(double dt) const
+	{
+		return slack + maxSpeed * (float)(dt > 0 ? dt : 0);
+	}
+};
+
+#endif // WORLDTRACK_HPP
@@ -0,0 +1,140 @@
+#ifndef ZONEMAP_HPP
+#define ZONEMAP_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// one counting zone: a polygon in colour pixels plus its own depth band
+struct Zone
+{
+	std::string name;
+	std::vector<cv::Point> polygon;
+	int minDist{ 0 };
+	int maxDist{ 0 };
+
+	int occupancy{ 0 }; // tracks inside right now
+	long long entered{ 0 };
+	long long exited{ 0 };
+};
+
+
+// counting zones compiled once into a coarse bitmask map
+// every cell holds one bit per zone covering it (zones may overlap), so finding the
+// zones of a track is one lookup at its centre plus a depth band check per set bit
+class ZoneMap
+{
+public:
+	static const int maxZones = 32;
+
+	bool add_zone(const Zone& zone)
+	{
+		if (zones_.size() >= maxZones || zone.polygon.size() < 3)
+			return false;
+		zones_.push_back(zone);
+		return true;
+	}
+
+	// rasterize every polygon at 1/cellSize of the colour frame
+	void build(const cv::Size& frame, int cellSize)
+	{
+		cellSize_ = cellSize;
+		width_ = frame.width / cellSize;
+		height_ = frame.height / cellSize;
+		cells_.assign(width_ * height_, 0);
+
+		cv::Mat raster(height_, width_, CV_8UC1);
+		for (int z = 0; z < zones_.size(); z++)
+		{
+			std::vector<std::vector<cv::Point>> polygon(1);
+			for (int i = 0; i < zones_[z].polygon.size(); i++)
+				polygon[0].push_back(cv::Point(zones_[z].polygon[i].x / cellSize, zones_[z].polygon[i].y / cellSize));
+
+			raster.setTo(cv::Scalar(0));
+			cv::fillPoly(raster, polygon, cv::Scalar(255));
+			for (int y = 0; y < height_; y++)
+			{
+				const uchar* row = raster.ptr<uchar>(y);
+				for (int x = 0; x < width_; x++)
+				{
+					if (row[x])
+						cells_[y * width_ + x] |= 1u << z;
+				}
+			}
+		}
+	}
+
+	bool empty() const { return zones_.empty(); }
+
+	// zones containing a point (colour pixels) at the given distance (mm); a distance of
+	// 0 (a depth hole) is in none, so callers skip the lookup rather than move to that
+	uint32_t lookup(const cv::Point& centre, int distance) const
+	{
+		const int x = centre.x / cellSize_;
+		const int y = centre.y / cellSize_;
+		if (x < 0 || y < 0 || x >= width_ || y >= height_)
+			return 0;
+
+		uint32_t bits = cells_[y * width_ + x];
+		for (uint32_t rest = bits; rest != 0; rest &= rest - 1)
+		{
+			const int z = lowest_bit(rest);
+			if (distance <= zones_[z].minDist || distance >= zones_[z].maxDist)
+				bits &= ~(1u << z);
+		}
+		return bits;
+	}
+
+	// moves a track from the zones it was in to the ones it is in now, with events
+	void move(uint32_t& current, uint32_t next)
+	{
+		const uint32_t entered = next & ~current;
+		const uint32_t exited = current & ~next;
+		for (uint32_t rest = entered; rest != 0; rest &= rest - 1)
+		{
+			Zone& zone = zones_[lowest_bit(rest)];
+			zone.entered++;
+			zone.occupancy++;
+			std::cout << "Zone " << zone.name << ": entered, occupancy " << zone.occupancy << std::endl;
+		}
+		for (uint32_t rest = exited; rest != 0; rest &= rest - 1)
+		{
+			Zone& zone = zones_[lowest_bit(rest)];
+			zone.exited++;
+			zone.occupancy--;
+			std::cout << "Zone " << zone.name << ": exited, occupancy " << zone.occupancy << std::endl;
+		}
+		current = next;
+	}
+
+	void print() const
+	{
+		for (int z = 0; z < zones_.size(); z++)
+		{
+			std::cout << "Zone " << zones_[z].name << ": occupancy " << zones_[z].occupancy
+				<< ", entered " << zones_[z].entered << ", exited " << zones_[z].exited << std::endl;
+		}
+	}
+
+private:
+	static int lowest_bit(uint32_t bits)
+	{
+		int z = 0;
+		while (!(bits & 1u))
+		{
+			bits >>= 1;
+			z++;
+		}
+		return z;
+	}
+
+	std::vector<Zone> zones_;
+	std::vector<uint32_t> cells_;
+	int cellSize_{ 4 };
+	int width_{ 0 };
+	int height_{ 0 };
+};
+
+#endif // ZONEMAP_HPP
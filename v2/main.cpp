@@ -35,7 +35,10 @@
 #include <conio.h>
 #include <string>
 #include <cmath>  
+#include <csignal>
+#include <cstring>
 #include <fstream>
+#include <limits>
 
 
 // opencv 
@@ -45,13 +48,72 @@
 // json
 #include <nlohmann/json.hpp>
 
+// pipeline stages
+#include "DepthBackground.hpp"
+#include "DepthFilter.hpp"
+#include "FaceDetector.hpp"
+#include "ImagePyramid.hpp"
+#include "LumaConvert.hpp"
+#include "FrameKernels.hpp"
+#include "FrameArena.hpp"
+#include "FrameMailbox.hpp"
+#include "FrameSync.hpp"
+#include "AppearanceCache.hpp"
+#include "ZoneMap.hpp"
+#include "CountLine.hpp"
+#include "SnapshotWriter.hpp"
+#include "TrackFilter.hpp"
+#include "WorldTrack.hpp"
+#include "QueueOccupancy.hpp"
+#include "IdleScheduler.hpp"
+#include "FlightRecorder.hpp"
+#include "CountingHarness.hpp"
+#include "BatchRunner.hpp"
+#include "Tracing.hpp"
+#include "SharedFrames.hpp"
+#include "ConfigWatcher.hpp"
+
 
 using namespace std;
 using json = nlohmann::json;
 
+// opt-in heap allocation counter - build with COUNT_ALLOCATIONS defined
+#ifdef COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+
+std::atomic<long long> heapAllocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+	heapAllocations++;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+long long allocation_count()
+{
+#ifdef COUNT_ALLOCATIONS
+	return heapAllocations.load();
+#else
+	return 0;
+#endif
+}
+
 // loading json file
 std::ifstream ifs("setting.json");
 json j = json::parse(ifs);
+json appliedSettings = j; // as last applied, what a reload is compared with
 
 // setting
 int minDist = j["minDist"];
@@ -62,28 +124,211 @@ int Ydepth = j["Ydepth"]; // y-axis
 int windowXSize = Xdepth * 2; // x-dimension
 int windowYSize = Ydepth * 2; // y-dimension
 
+// steadying the depth frame - temporal smoothing, hole filling, spike removal
+bool depthFilter = j.value("depthFilter", false);
+int depthFilterJump = j.value("depthFilterJump", 100); // mm per frame taken as movement, not noise
+int depthFilterSmoothing = j.value("depthFilterSmoothing", 1); // a new reading weighs 1 / 2^this
+int depthFilterHold = j.value("depthFilterHold", 3); // frames a hole keeps the last reading
+
+// depth background model - only foreground regions are searched for faces
+bool backgroundModel = j.value("backgroundModel", false);
+int bgThreshold = j.value("bgThreshold", 150); // mm in front of the background
+int bgMinArea = j.value("bgMinArea", 20); // depth pixels
+int bgPadding = j.value("bgPadding", 16); // colour pixels around each region
+int bgStep = j.value("bgStep", 20); // mm per frame the background follows the scene
+double bgAbsorbMinutes = j.value("bgAbsorbMinutes", 10.0); // standing still this long -> background
+
+// face detector - "cascade" or "dnn"
+std::string detectorName = j.value("detector", std::string("cascade"));
+std::string cascadeFile = j.value("cascadeFile", std::string("C:\\C++ External Libraries\\opencv_3_4_5\\sources\\data\\haarcascades\\haarcascade_frontalface_alt.xml"));
+std::string dnnConfig = j.value("dnnConfig", std::string("deploy.prototxt"));
+std::string dnnModel = j.value("dnnModel", std::string("res10_300x300_ssd_iter_140000.caffemodel"));
+float dnnConfidence = j.value("dnnConfidence", 0.5f);
+int dnnThreads = j.value("dnnThreads", 0); // 0 leaves opencv's default
+int dnnPinCpu = j.value("dnnPinCpu", -1); // -1 does not pin the detection thread
+bool detectorCompare = j.value("detectorCompare", false); // run the other detector alongside and report both
+
+// grey detection on a smaller pyramid level, as small as the face at maxDist allows
+bool detectionScaling = j.value("detectionScaling", false);
+float faceWidth = j.value("faceWidth", 140.0f); // mm, a narrow face
+float colourFov = j.value("colourFov", 60.0f); // horizontal degrees the colour camera sees
+int detectionMinFace = j.value("detectionMinFace", 36); // px the face at maxDist keeps, the detector needs 30
+bool detectionRefine = j.value("detectionRefine", false); // detect again at full size around every hit
+
+// headless - no windows, and no colour frame unless the detector needs one
+bool headless = j.value("headless", false);
+int lumaScale = j.value("lumaScale", 1); // 1, 2 or 4 - grey detection frame downscaled by this
+
+// frames arriving faster than detection - "oldest" (newest wins), "newest" or "nth"
+std::string dropPolicy = j.value("dropPolicy", std::string("oldest"));
+int processEveryNth = j.value("processEveryNth", 2); // with "nth"
+double syncTolerance = j.value("syncTolerance", 20.0); // ms between a colour frame and its depth frame
+
+// re-identifying people who were lost for a while instead of counting them again
+bool reid = j.value("reid", false);
+int reidCapacity = j.value("reidCapacity", 32); // lost tracks remembered
+double reidTimeout = j.value("reidTimeout", 30.0); // s a lost track is remembered
+float reidThreshold = j.value("reidThreshold", 0.35f); // signature distance still taken as the same person
+
+// count lines
+int lineHysteresis = j.value("lineHysteresis", 10); // px either side of a line that do not change the side
+
+// face snapshots saved when a face starts being tracked
+bool snapshots = j.value("snapshots", false);
+std::string snapshotDir = j.value("snapshotDir", std::string("snapshots")); // has to exist
+std::string snapshotFormat = j.value("snapshotFormat", std::string("jpg")); // "jpg" or "png"
+int snapshotWorkers = j.value("snapshotWorkers", 1);
+int snapshotQueue = j.value("snapshotQueue", 8); // snapshots waiting before new ones are dropped
+
+// predicting where tracked faces are between detections
+bool kalman = j.value("kalman", false);
+float kalmanProcessNoise = j.value("kalmanProcessNoise", 200.0f); // px/s^2
+float kalmanMeasurementNoise = j.value("kalmanMeasurementNoise", 4.0f); // px
+float kalmanDepthProcessNoise = j.value("kalmanDepthProcessNoise", 1000.0f); // mm/s^2
+float kalmanDepthMeasurementNoise = j.value("kalmanDepthMeasurementNoise", 50.0f); // mm
+int kalmanDepthGate = j.value("kalmanDepthGate", 500); // mm a detection may be off the predicted distance
+
+// matching tracked faces by their position in the room instead of on screen
+bool worldTracking = j.value("worldTracking", false);
+float worldMaxSpeed = j.value("worldMaxSpeed", 3000.0f); // mm/s anyone can move
+float worldSlack = j.value("worldSlack", 300.0f); // mm of depth noise on top
+
+// how far back the queue reaches, from the point frame (mm, camera space, camera held level)
+bool queueLength = j.value("queueLength", false);
+std::vector<float> queueFrom = j.value("queueFrom", std::vector<float>{ 0, 1000 }); // [x, z] head of the queue
+std::vector<float> queueTo = j.value("queueTo", std::vector<float>{ 0, 5000 }); // [x, z] where it ends up at most
+float queueWidth = j.value("queueWidth", 800.0f); // band either side of the queue axis, in total
+float queueCell = j.value("queueCell", 100.0f); // floor grid cell
+float queueMinY = j.value("queueMinY", -1200.0f); // heights counted, relative to the camera
+float queueMaxY = j.value("queueMaxY", 300.0f);
+float queueMinPoints = j.value("queueMinPoints", 200.0f); // points in an occupied cell, as seen from 1 m
+float queueGap = j.value("queueGap", 1000.0f); // longest empty stretch still part of the queue
+
+// slowing detection down while nothing moves between minDist and maxDist
+bool idle = j.value("idle", false);
+double idleAfter = j.value("idleAfter", 30.0); // s without motion before idling
+double idleInterval = j.value("idleInterval", 2.0); // s between detections while idle
+int idleCellThreshold = j.value("idleCellThreshold", 100); // mm a grid cell has to change by
+int idleMinCells = j.value("idleMinCells", 2); // changed cells that count as motion
+int idleSleep = j.value("idleSleep", 20); // ms the main loop sleeps per pass while idle
+
+// last few seconds of frames and events kept in memory, written out on request
+bool recorder = j.value("recorder", false);
+double recorderSeconds = j.value("recorderSeconds", 30.0);
+int recorderMemory = j.value("recorderMemory", 64); // MB for the compressed frames
+int recorderQuality = j.value("recorderQuality", 50); // jpeg quality of the colour frames
+std::string recorderDir = j.value("recorderDir", std::string(".")); // where dumps go
+int recorderAnomalyCount = j.value("recorderAnomalyCount", 5); // people counted within a second that trigger a dump, 0 never
+
+// spans of every pipeline stage, written as chrome trace-event json on exit or request
+bool trace = j.value("trace", false);
+std::string traceFile = j.value("traceFile", std::string("trace.json"));
+int traceCapacity = j.value("traceCapacity", 200000); // spans kept per thread
+
+// frames and tracks for other local processes, through shared memory
+bool sharedMemory = j.value("sharedMemory", false);
+std::string sharedMemoryName = j.value("sharedMemoryName", std::string("depthsensor"));
+int sharedMemorySlots = j.value("sharedMemorySlots", 4);
+int sharedMemoryWidth = j.value("sharedMemoryWidth", 640); // largest colour frame, px
+int sharedMemoryHeight = j.value("sharedMemoryHeight", 480);
+
+// picking up changes to setting.json while running
+bool reloadSettings = j.value("reloadSettings", false);
+
 
 // global variables
-cv::Mat DisplayImage = cv::Mat::zeros(cv::Size(Xdepth, Ydepth), CV_8UC3); // retrieving the pixel RGB 
-int distanceValue[640][480] = { 0 };
+bool needColour = true; // colour frame is filled
+bool lumaInput = false; // luma frame is filled
+bool replaying = false; // frames come from a recording, timed by its own clock
+
+// a colour frame on its way from the colour listener to detection
+struct ColourFrame
+{
+	cv::Mat colour; // retrieving the pixel RGB
+	cv::Mat luma; // equalized grey straight from the sensor buffer
+	int lumaScale{ 1 }; // luma was downscaled by this
+	long long index{ 0 }; // sensor frame index
+	std::chrono::steady_clock::time_point captured; // when the sdk delivered it
+};
+FrameMailbox<ColourFrame> colourMailbox;
+
+// recent depth frames, paired with each colour frame before detection
+FrameSync frameSync;
 bool colourData = false;
 int displayTimer = 0;
 
 
-vector<cv::Rect> faces_verifying;
-vector<bool> faces_verifyingExist;
-vector<int> faces_verifyingStartTime;
-vector<int> faces_verifyingLastSeen;
+// verifying and tracked faces (CountingCore.hpp), and what the live pipeline keeps
+// for every tracked one, same index as peopleCounter.tracking()
+V2Counter peopleCounter;
+vector<AppearanceSignature> faces_trackingSignature;
+vector<uint32_t> faces_trackingZones; // one bit per counting zone the face is in
+vector<TrackPath> faces_trackingPath; // recent centres, for the count lines
+vector<cv::Rect> frameFaces; // detections of the last frame, for the window
+
+QueueOccupancy queueOccupancy;
 
-vector<cv::Rect> faces_tracking;
-vector<bool> faces_trackingExist;
-vector<int> faces_trackingStartTime;
-vector<int> faces_trackingLastSeen;
+IdleScheduler idleScheduler;
 
-vector<int> faces_IndexDel;
+FlightRecorder flightRecorder;
+int recorderLastCount = 0;
+volatile std::sig_atomic_t recorderSignal = 0;
+
+// dump request from outside: SIGBREAK (ctrl+break) on windows, SIGUSR1 elsewhere
+void on_recorder_signal(int)
+{
+	recorderSignal = 1;
+}
+
+// trace written from the main loop: T in the colour window, or SIGUSR2 outside windows
+volatile std::sig_atomic_t traceSignal = 0;
+void on_trace_signal(int)
+{
+	traceSignal = 1;
+}
 
 int numberOfFaces = 0;
 
+AppearanceCache appearanceCache;
+
+// counting zones and count lines from setting.json
+ZoneMap zoneMap;
+CountLines countLines;
+
+SnapshotWriter snapshotWriter;
+
+SharedFramePublisher sharedFrames;
+vector<SharedTrack> sharedTracks;
+
+// the face vectors above are reserved for this many faces so they never reallocate
+const int maxFaces = 64;
+
+// transient per-frame containers live in the arena, reset at the start of every frame
+FrameArena frameArena(64 * 1024);
+typedef ArenaVector<cv::Rect> FaceList;
+AllocationStats allocationStats;
+
+DepthBackground depthBackground;
+DepthFilter depthFiltering;
+
+std::unique_ptr<FaceDetector> faceDetector;
+std::unique_ptr<FaceDetector> compareDetector;
+DetectorStats faceDetectorStats;
+DetectorStats compareDetectorStats;
+
+// one pyramid per frame, shared by every consumer of the colour frame
+ImagePyramid framePyramid;
+
+// candidate regions, handed to the detector as one batch of images
+vector<cv::Rect> detectionRegions;
+vector<cv::Rect> detectionScaled; // the same regions in the detector's input image
+vector<cv::Mat> detectionImages;
+vector<vector<cv::Rect>> detectionResults;
+vector<vector<cv::Rect>> compareResults;
+vector<cv::Rect> refineRegions; // around the hits of a reduced scale detection
+vector<cv::Mat> refineImages;
+vector<vector<cv::Rect>> refineResults;
+
 
 class ColorFrameListener : public astra::FrameListener
 {
@@ -115,36 +360,63 @@ public:
 	virtual void on_frame_ready(astra::StreamReader& reader, astra::Frame& frame) override
 	{
 		const astra::ColorFrame colorFrame = frame.get<astra::ColorFrame>();
+		tracer().set_frame(colorFrame.frame_index());
+		TraceSpan span("colour frame");
 
 		int width = colorFrame.width();
 		int height = colorFrame.height();
 
-		init_texture(width, height);
-
 		const astra::RgbPixel* colorData = colorFrame.data();
+		const uint8_t* rgb = reinterpret_cast<const uint8_t*>(colorData);
+
+		// the loops for this frame size, picked again only when the mode changes
+		if (width != lastWidth_ || height != lastHeight_)
+		{
+			lastWidth_ = width;
+			lastHeight_ = height;
+			toBgr_ = colour_to_bgr(width, height);
+			toRgba_ = colour_to_rgba(width, height);
+		}
 
-		// getting colour image
+		// getting colour image, straight into the mailbox's free buffer
 		if (colourData) {
-			for (int i = 0; i < width*height; i++)
+			TraceSpan copy("colour copy");
+			ColourFrame& slot = colourMailbox.back();
+			if (needColour)
 			{
-				int index = i % width + width * (i / width);
-				DisplayImage.at<uchar>(i / width, 3 * (i%width)) = colorData[index].b;
-				DisplayImage.at<uchar>(i / width, 3 * (i%width) + 1) = colorData[index].g;
-				DisplayImage.at<uchar>(i / width, 3 * (i%width) + 2) = colorData[index].r;
+				slot.colour.create(height, width, CV_8UC3);
+				toBgr_(rgb, slot.colour.data, width, height);
 			}
+			else
+			{
+				// an image left in the buffer from before a detector swap is not this frame
+				slot.colour.release();
+			}
+			// grey detection frame read directly from the sensor buffer
+			if (lumaInput)
+			{
+				rgb_to_luma(rgb, width, height, lumaScale, true, slot.luma);
+				slot.lumaScale = lumaScale;
+			}
+			else
+			{
+				slot.luma.release();
+			}
+			slot.index = colorFrame.frame_index();
+			slot.captured = std::chrono::steady_clock::now();
+			colourMailbox.publish();
 		}
 		colourData = true;
 
-
-		for (int i = 0; i < width * height; i++)
+		if (headless)
 		{
-
-			int rgbaOffset = i * 4;
-			displayBuffer_[rgbaOffset] = colorData[i].r;
-			displayBuffer_[rgbaOffset + 1] = colorData[i].g;
-			displayBuffer_[rgbaOffset + 2] = colorData[i].b;
-			displayBuffer_[rgbaOffset + 3] = 255;
+			return;
 		}
+
+		init_texture(width, height);
+
+		TraceSpan display("colour display");
+		toRgba_(rgb, displayBuffer_.get(), width, height);
 		texture_.update(displayBuffer_.get());
 	}
 
@@ -176,8 +448,10 @@ private:
 
 	using buffer_ptr = std::unique_ptr<astra::RgbPixel[]>;
 	buffer_ptr buffer_;
-	unsigned int lastWidth_;
-	unsigned int lastHeight_;
+	int lastWidth_{ 0 };
+	int lastHeight_{ 0 };
+	FrameKernel toBgr_{ nullptr };
+	FrameKernel toRgba_{ nullptr };
 
 };
 
@@ -205,6 +479,7 @@ public:
 
 			displayBuffer_ = BufferPtr(new uint8_t[byteLength]);
 			std::fill(&displayBuffer_[0], &displayBuffer_[0] + byteLength, 0);
+			toRgba_ = depth_to_rgba(width, height);
 
 			texture_.create(displayWidth_, displayHeight_);
 			sprite_.setTexture(texture_, true);
@@ -219,69 +494,52 @@ public:
 		const astra::PointFrame pointFrame = frame.get<astra::PointFrame>();
 		const int width = pointFrame.width();
 		const int height = pointFrame.height();
-
-		init_texture(width, height);
+		tracer().set_frame(pointFrame.frame_index());
+		TraceSpan span("depth frame");
 
 		copy_depth_data(frame);
 
+		if (headless)
+		{
+			return;
+		}
+
+		init_texture(width, height);
+
+		TraceSpan display("depth display");
 		visualizer_.update(pointFrame);
 
 		const astra::RgbPixel* vizBuffer = visualizer_.get_output();
-
-		for (int i = 0; i < width * height; i++)
-		{
-			const int rgbaOffset = i * 4;
-			displayBuffer_[rgbaOffset] = vizBuffer[i].r;
-			displayBuffer_[rgbaOffset + 1] = vizBuffer[i].b;
-			displayBuffer_[rgbaOffset + 2] = vizBuffer[i].g;
-			displayBuffer_[rgbaOffset + 3] = 255;
-		}
+		toRgba_(reinterpret_cast<const uint8_t*>(vizBuffer), displayBuffer_.get(), width, height);
 
 		texture_.update(displayBuffer_.get());
 	}
 
+	// depth in mm goes straight into the synchronizer's ring, one int16_t per pixel
+	// (with a millimetre pixel format the world z of a pixel is its depth value)
 	void copy_depth_data(astra::Frame& frame)
 	{
 		const astra::DepthFrame depthFrame = frame.get<astra::DepthFrame>();
 
 		if (depthFrame.is_valid())
 		{
-			const int width = depthFrame.width();
-			const int height = depthFrame.height();
-			if (!depthData_ || width != depthWidth_ || height != depthHeight_)
+			TraceSpan span("depth copy");
+			DepthSlot& slot = frameSync.back(depthFrame.width(), depthFrame.height());
+			depthFrame.copy_to(slot.depth.data());
+			if (depthFilter)
 			{
-				depthWidth_ = width;
-				depthHeight_ = height;
-
-				// texture is RGBA
-				const int byteLength = depthWidth_ * depthHeight_ * sizeof(uint16_t);
-
-				depthData_ = DepthPtr(new int16_t[byteLength]);
+				TraceSpan filter("depth filter");
+				depthFiltering.apply(slot.depth.data(), slot.width, slot.height);
 			}
 
-			depthFrame.copy_to(&depthData_[0]);
-		}
-	}
-
-	// ------------------------- objects detection of the middle section ------------------------- //
-	void update_depth(sf::RenderWindow& window, const astra::CoordinateMapper& coordinateMapper) {
-		// aim: gathering distance value
-		for (int x640 = 0; x640 < 160; x640++) { // based on depth 160 or 640
-			for (int y480 = 0; y480 < 120; y480++) {
-				mouseX_ = x640;
-				mouseY_ = y480;
-				if (mouseX_ >= depthWidth_ ||
-					mouseY_ >= depthHeight_ ||
-					mouseX_ < 0 ||
-					mouseY_ < 0) {
-					return;
-				}
-				const size_t index = (depthWidth_ * mouseY_ + mouseX_);
-				const short z = depthData_[index];
-				coordinateMapper.convert_depth_to_world(float(mouseX_), float(mouseY_), float(z), mouseWorldX_, mouseWorldY_, mouseWorldZ_);
-				distanceValue[x640][y480] = mouseWorldZ_; // recording distance value
-
+			// the point frame of the same depth frame, for world-space tracking and the queue length
+			const astra::PointFrame pointFrame = frame.get<astra::PointFrame>();
+			if ((worldTracking || queueLength) && pointFrame.is_valid() && pointFrame.length() == slot.depth.size())
+			{
+				slot.points.resize(pointFrame.length());
+				std::memcpy(slot.points.data(), pointFrame.data(), pointFrame.length() * sizeof(WorldPoint));
 			}
+			frameSync.commit(depthFrame.frame_index());
 		}
 	}
 
@@ -317,18 +575,7 @@ private:
 
 	using BufferPtr = std::unique_ptr<uint8_t[]>;
 	BufferPtr displayBuffer_{ nullptr };
-
-	int depthWidth_{ 0 };
-	int depthHeight_{ 0 };
-
-	using DepthPtr = std::unique_ptr<int16_t[]>;
-	DepthPtr depthData_{ nullptr };
-
-	int mouseX_{ 0 };
-	int mouseY_{ 0 };
-	float mouseWorldX_{ 0 };
-	float mouseWorldY_{ 0 };
-	float mouseWorldZ_{ 0 };
+	FrameKernel toRgba_{ nullptr }; // chosen with the texture size
 
 };
 
@@ -357,13 +604,306 @@ astra::DepthStream configure_depth(astra::StreamReader& reader)
 }
 
 
+// counting zones from setting.json, compiled once into the zone map
+// "zones": [{ "name": "queue", "polygon": [[x, y], ...], "minDist": 500, "maxDist": 2500 }, ...]
+void load_zones()
+{
+	if (j.count("zones") == 0)
+	{
+		return;
+	}
+
+	for (const auto& z : j["zones"])
+	{
+		Zone zone;
+		zone.name = z.value("name", std::string("zone"));
+		zone.minDist = z.value("minDist", minDist);
+		zone.maxDist = z.value("maxDist", maxDist);
+		for (const auto& p : z["polygon"])
+		{
+			zone.polygon.push_back(cv::Point(p[0].get<int>(), p[1].get<int>()));
+		}
+		if (!zoneMap.add_zone(zone))
+		{
+			std::cout << "Ignoring zone " << zone.name << std::endl;
+		}
+	}
+
+	// cells of 4x4 colour pixels, the same grid as the depth frame
+	zoneMap.build(cv::Size(Xdepth, Ydepth), 4);
+}
+
+
+// count lines from setting.json
+// "countLines": [{ "name": "door", "from": [x, y], "to": [x, y], "hysteresis": 10 }, ...]
+void load_count_lines()
+{
+	if (j.count("countLines") == 0)
+	{
+		return;
+	}
+
+	for (const auto& l : j["countLines"])
+	{
+		CountLine line;
+		line.name = l.value("name", std::string("line"));
+		line.from = cv::Point(l["from"][0].get<int>(), l["from"][1].get<int>());
+		line.to = cv::Point(l["to"][0].get<int>(), l["to"][1].get<int>());
+		line.hysteresis = l.value("hysteresis", lineHysteresis);
+		if (!countLines.add_line(line))
+		{
+			std::cout << "Ignoring count line " << line.name << std::endl;
+		}
+	}
+}
+
+
+// creating the detector named in setting.json
+std::unique_ptr<FaceDetector> create_detector(const std::string& name)
+{
+	std::unique_ptr<FaceDetector> detector;
+	if (name == "dnn")
+		detector.reset(new DnnFaceDetector(dnnConfig, dnnModel, dnnConfidence, dnnThreads, dnnPinCpu));
+	else
+		detector.reset(new CascadeFaceDetector(cascadeFile));
+
+	if (!detector->load())
+	{
+		std::cout << "Unable to load the " << detector->name() << " face detector" << std::endl;
+		detector.reset();
+	}
+	return detector;
+}
+
+
+// how far the frame can be shrunk for detection: the smallest face in the distance band,
+// the one at maxDist, still has to come out at detectionMinFace pixels
+double detection_scale(int frameWidth)
+{
+	const double focal = frameWidth / 2.0 / std::tan(colourFov * CV_PI / 360);
+	const double smallest = faceWidth * focal / maxDist;
+	return std::min(1.0, detectionMinFace / smallest);
+}
+
+
+// every face found at a reduced scale is looked for again in a full size window around it,
+// which sharpens the box; a face the second pass does not find keeps its coarse box
+void refine_faces(FaceDetector& detector, ImagePyramid& pyramid, FaceList& faces, int first)
+{
+	const cv::Mat& source = pyramid.level(0);
+	const double scale = pyramid.scale(0);
+	const cv::Rect bounds(0, 0, source.cols, source.rows);
+	refineRegions.clear();
+	refineImages.clear();
+	for (int i = first; i < faces.size(); i++)
+	{
+		// half a face of context on every side
+		const cv::Rect& f = faces[i];
+		refineRegions.push_back(cv::Rect(cvRound((f.x - f.width / 2) * scale), cvRound((f.y - f.height / 2) * scale),
+			cvRound(f.width * 2 * scale), cvRound(f.height * 2 * scale)) & bounds);
+		refineImages.push_back(source(refineRegions.back()));
+	}
+
+	detector.detect(refineImages, refineResults);
+
+	for (int i = 0; i < refineResults.size(); i++)
+	{
+		const cv::Rect* best = nullptr;
+		for (int j = 0; j < refineResults[i].size(); j++)
+		{
+			if (!best || refineResults[i][j].area() > best->area())
+				best = &refineResults[i][j];
+		}
+		if (best)
+		{
+			faces[first + i] = cv::Rect(cvRound((best->x + refineRegions[i].x) / scale), cvRound((best->y + refineRegions[i].y) / scale),
+				cvRound(best->width / scale), cvRound(best->height / scale));
+		}
+	}
+}
+
+
+// running a detector over the candidate regions and timing it,
+// the faces found are put back into frame coordinates
+void run_detector(FaceDetector& detector, ImagePyramid& pyramid, vector<vector<cv::Rect>>& results, FaceList& faces, DetectorStats& stats)
+{
+	// cutting the regions out of the pyramid in the form the detector takes;
+	// the dnn scales whatever it gets to 300x300 itself, so only grey input is reduced
+	const bool grey = detector.grey_input();
+	const int level = grey && detectionScaling ? pyramid.level_for_scale(detection_scale(pyramid.frame_size().width)) : 0;
+	const cv::Mat& source = grey ? pyramid.level(level) : pyramid.colour();
+	const double scale = grey ? pyramid.scale(level) : 1.0;
+	const cv::Rect bounds(0, 0, source.cols, source.rows);
+	detectionImages.clear();
+	detectionScaled.clear();
+	for (int i = 0; i < detectionRegions.size(); i++)
+	{
+		const cv::Rect& r = detectionRegions[i];
+		detectionScaled.push_back(cv::Rect(cvRound(r.x * scale), cvRound(r.y * scale), cvRound(r.width * scale), cvRound(r.height * scale)) & bounds);
+		detectionImages.push_back(source(detectionScaled.back()));
+	}
+
+	TraceSpan span("detection");
+	auto start = std::chrono::high_resolution_clock::now();
+	detector.detect(detectionImages, results);
+
+	const int first = (int)faces.size();
+	for (int i = 0; i < results.size(); i++)
+	{
+		for (int j = 0; j < results[i].size(); j++)
+		{
+			const cv::Rect& r = results[i][j];
+			faces.push_back(cv::Rect(cvRound((r.x + detectionScaled[i].x) / scale), cvRound((r.y + detectionScaled[i].y) / scale),
+				cvRound(r.width / scale), cvRound(r.height / scale)));
+		}
+	}
+	if (detectionRefine && level > 0 && faces.size() > first)
+	{
+		refine_faces(detector, pyramid, faces, first);
+	}
+	stats.millis += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	stats.frames++;
+}
+
+
+// a tracking event for the flight recorder, with the face it is about
+void record_event(const char* what, const cv::Rect& r)
+{
+	if (!recorder)
+	{
+		return;
+	}
+	char text[96];
+	std::snprintf(text, sizeof(text), "%s %d,%d %dx%d, count %d", what, r.x, r.y, r.width, r.height, numberOfFaces);
+	flightRecorder.event(text);
+}
+
+
+// distance of a face from the depth frame paired with its colour frame
+int face_distance(const DepthSlot& depth, const cv::Rect& r)
+{
+	// divide by 4 since depth viewer is 4x smaller in dimension
+	return depth.at((r.x + r.width / 2) / 4, (r.y + r.height / 2) / 4);
+}
+
+
+// what the live pipeline does as faces come and go in peopleCounter - appearance,
+// snapshots, zones, count lines, events - all taken from the frame before anything is
+// drawn over it
+class LiveHooks : public CountingHooks
+{
+public:
+	LiveHooks(const cv::Mat& frame, const cv::Mat& luma, const DepthSlot& depth, const FaceList& faces,
+		const ArenaVector<int>& distances, time_t timer, double seconds)
+		: frame_(frame), luma_(luma), depth_(depth), faces_(faces), distances_(distances), timer_(timer), seconds_(seconds)
+	{}
+
+	bool reidentify(int face) override
+	{
+		if (!reid)
+		{
+			return false;
+		}
+		signature_ = compute_signature(frame_, luma_, 1.0 / lumaScale, depth_, faces_[face]);
+		if (!appearanceCache.match(signature_, seconds_))
+		{
+			return false;
+		}
+		record_event("re-identified", faces_[face]);
+		return true;
+	}
+
+	void added(int track, int face, bool reidentified) override
+	{
+		const cv::Rect& r = faces_[face];
+		if (!reidentified)
+		{
+			// appearance of a face about to be tracked
+			signature_ = AppearanceSignature();
+			if (reid)
+			{
+				signature_ = compute_signature(frame_, luma_, 1.0 / lumaScale, depth_, r);
+			}
+			// so is its snapshot, in colour unless only the grey frame exists
+			if (snapshots)
+			{
+				if (!frame_.empty())
+				{
+					snapshotWriter.submit(frame_, r, (long long)timer_);
+				}
+				else
+				{
+					snapshotWriter.submit(luma_, cv::Rect(r.x / lumaScale, r.y / lumaScale,
+						r.width / lumaScale, r.height / lumaScale), (long long)timer_);
+				}
+			}
+			record_event("tracking", r);
+		}
+		faces_trackingSignature.push_back(signature_);
+		faces_trackingZones.push_back(0);
+		faces_trackingPath.push_back(TrackPath());
+	}
+
+	void matched(int track, int face) override
+	{
+		const cv::Rect& r = faces_[face];
+		// appearance refreshed about once a second
+		if (reid && peopleCounter.tracking()[track].lastSeen != seconds_)
+		{
+			faces_trackingSignature[track].blend(compute_signature(frame_, luma_, 1.0 / lumaScale, depth_, r), 0.2f);
+		}
+
+		// zones and count lines use the centre of the face
+		const cv::Point centre(r.x + r.width / 2, r.y + r.height / 2);
+		// a depth hole is no reading, not a step out of every zone: the zones stay as they were
+		if (!zoneMap.empty() && distances_[face] > 0)
+		{
+			zoneMap.move(faces_trackingZones[track], zoneMap.lookup(centre, distances_[face]));
+		}
+		if (!countLines.empty())
+		{
+			countLines.update(faces_trackingPath[track], centre, seconds_);
+		}
+	}
+
+	void lost(int track) override
+	{
+		const V2Counter::Track& t = peopleCounter.tracking()[track];
+		if (!t.counted)
+		{
+			numberOfFaces++;
+			record_event("counted", t.box);
+		}
+		if (reid)
+		{
+			appearanceCache.insert(faces_trackingSignature[track], seconds_);
+		}
+		zoneMap.move(faces_trackingZones[track], 0);
+		faces_trackingSignature.erase(faces_trackingSignature.begin() + track);
+		faces_trackingZones.erase(faces_trackingZones.begin() + track);
+		faces_trackingPath.erase(faces_trackingPath.begin() + track);
+	}
+
+private:
+	const cv::Mat& frame_;
+	const cv::Mat& luma_;
+	const DepthSlot& depth_;
+	const FaceList& faces_;
+	const ArenaVector<int>& distances_;
+	time_t timer_;
+	double seconds_;
+	AppearanceSignature signature_; // of the face reidentify() was last asked about
+};
+
+
 // face detection
-void detectAndDraw(cv::Mat& frame) {
+void detectAndDraw(cv::Mat& frame, const cv::Mat& luma, const DepthSlot& depth, std::chrono::steady_clock::time_point captured) {
 
-	// loading in face detection
-	double scale = 1;
-	cv::CascadeClassifier face_cascade;
-	face_cascade.load("C:\\C++ External Libraries\\opencv_3_4_5\\sources\\data\\haarcascades\\haarcascade_frontalface_alt.xml");
+	// capture time in seconds, for the world-space speed limit
+	const double now = std::chrono::duration<double>(captured.time_since_epoch()).count();
+
+	// everything allocated from the arena last frame is gone by now
+	frameArena.reset();
 
 	// setting up current time access
 	time_t timer;
@@ -372,200 +912,820 @@ void detectAndDraw(cv::Mat& frame) {
 	y2k.tm_hour = 0;   y2k.tm_min = 0; y2k.tm_sec = 0;
 	y2k.tm_year = 100; y2k.tm_mon = 0; y2k.tm_mday = 1;
 
+	// a recording runs on the time it was captured at, however fast it is replayed
+	if (replaying)
+	{
+		timer = mktime(&y2k) + (time_t)now;
+	}
+
+	// nothing is converted or scaled until a detector asks for it
+	if (lumaInput)
+	{
+		framePyramid.reset(frame, luma, 1.0 / lumaScale);
+	}
+	else
+	{
+		framePyramid.reset(frame);
+	}
+	const cv::Rect bounds(0, 0, framePyramid.frame_size().width, framePyramid.frame_size().height);
+
+	// candidate regions - the whole frame, or only the foreground regions
+	detectionRegions.clear();
+	if (!backgroundModel)
+	{
+		detectionRegions.push_back(bounds);
+	}
+	else
+	{
+		// an empty scene leaves no candidates and skips detection entirely
+		for (int i = 0; i < depthBackground.regions().size(); i++)
+		{
+			// multiply by 4 since depth viewer is 4x smaller in dimension
+			const cv::Rect r = depthBackground.regions()[i];
+			cv::Rect roi = cv::Rect(r.x * 4 - bgPadding, r.y * 4 - bgPadding,
+				r.width * 4 + bgPadding * 2, r.height * 4 + bgPadding * 2) & bounds;
+			if (roi.width < 30 || roi.height < 30)
+				continue;
+
+			detectionRegions.push_back(roi);
+		}
+	}
 
 	// load all detected faces into 'faces' vector
-	std::vector<cv::Rect> faces;
-	face_cascade.detectMultiScale(frame, faces, 1.1, 2, 0 | CV_HAAR_SCALE_IMAGE, cv::Size(30, 30));
+	FaceList faces(frameArena);
+	faces.reserve(maxFaces);
+	run_detector(*faceDetector, framePyramid, detectionResults, faces, faceDetectorStats);
+
+	// same candidates through the other detector, for the side by side report
+	if (compareDetector)
+	{
+		FaceList others(frameArena);
+		others.reserve(maxFaces);
+		run_detector(*compareDetector, framePyramid, compareResults, others, compareDetectorStats);
+
+		faceDetectorStats.faces += faces.size();
+		faceDetectorStats.matched += count_matched(faces, others);
+		compareDetectorStats.faces += others.size();
+		compareDetectorStats.matched += count_matched(others, faces);
+	}
+
 
 
-	// display message
-	if (difftime(timer, mktime(&y2k)) - displayTimer > 1) {
-		std::cout << "Current count: " << numberOfFaces << std::endl;
-		displayTimer = difftime(timer, mktime(&y2k));
+
+	// detections to tracks, up to the display
+	TraceSpan association("association");
+
+	// the distance of every detection, and where it is in the room - for world-space
+	// tracking, and for the shared tracks whenever the point frame is there
+	ArenaVector<int> faceDistance(faces.size(), 0, frameArena);
+	ArenaVector<WorldPoint> faceWorld(faces.size(), WorldPoint(), frameArena);
+	for (int j = 0; j < faces.size(); j++)
+	{
+		faceDistance[j] = face_distance(depth, faces[j]);
+		if (!depth.points.empty())
+		{
+			face_world(depth, faces[j], faceWorld[j]);
+		}
 	}
 
+	// verifying faces, tracked faces, then new ones (CountingCore.hpp)
+	const double seconds = difftime(timer, mktime(&y2k));
+	LiveHooks hooks(frame, luma, depth, faces, faceDistance, timer, seconds);
+	peopleCounter.update(faces, faceDistance, faceWorld.data(), now, seconds, &hooks);
 
-	// all tracked and verifying have to be detected again
-	// dealing with verifying faces
-	for (int i = 0; i < faces_verifyingExist.size(); i++)
+	// kept for show_faces(), which draws them once the frame has been handed on
+	if (!headless)
 	{
-		faces_verifyingExist[i] = false;
-		// loop through all faces available
-		for (int j = 0; j < faces.size(); j++)
+		frameFaces.assign(faces.begin(), faces.end());
+	}
+	association.end();
+}
+
+// every detection of the frame just associated, blue once it belongs to a tracked face
+void show_faces(cv::Mat& frame)
+{
+	TraceSpan render("render");
+	for (int j = 0; j < frameFaces.size(); j++)
+	{
+		const cv::Rect& r = frameFaces[j];
+		cv::Scalar color = cv::Scalar(0, 255, 0);
+		for (int i = 0; i < peopleCounter.tracking().size(); i++)
 		{
-			// detected in boundary -> exist
-			if (!(faces[j].x + faces[j].width < faces_verifying[i].x) &&
-				!(faces[j].x > faces_verifying[i].x + faces_verifying[i].width) &&
-				!(faces[j].y + faces[j].height < faces_verifying[i].y) &&
-				!(faces[j].y > faces_verifying[i].y + faces_verifying[i].height)
-				)
+			if (peopleCounter.ids()[j] == peopleCounter.tracking()[i].id)
 			{
-				faces_verifyingExist[i] = true;
-				cv::Scalar color = cv::Scalar(0, 255, 0);
-				rectangle(frame, cvPoint(cvRound(faces_verifying.at(i).x*scale), cvRound(faces_verifying.at(i).y*scale)), cvPoint(cvRound((faces_verifying.at(i).x +
-					faces_verifying.at(i).width - 1)*scale), cvRound((faces_verifying.at(i).y + faces_verifying.at(i).height - 1)*scale)), color, 3, 8, 0);
-				// adjust new values
-				faces_verifying[i] = faces[j];
-				faces_verifyingLastSeen[i] = difftime(timer, mktime(&y2k));
-
-				// if exist -> look at time -> put in tracking and remove from verifying
-				if (difftime(timer, mktime(&y2k)) - faces_verifyingStartTime.at(i) > 2)
-				{
-					faces_IndexDel.push_back(i);
-
-					faces_tracking.push_back(faces_verifying.at(i));
-					faces_trackingLastSeen.push_back(difftime(timer, mktime(&y2k)));
-					faces_trackingStartTime.push_back(difftime(timer, mktime(&y2k)));
-					faces_trackingExist.push_back(true);
-				}
+				color = cv::Scalar(255, 0, 0);
 			}
-			break;
 		}
+		rectangle(frame, cvPoint(r.x, r.y), cvPoint(r.x + r.width - 1, r.y + r.height - 1), color, 3, 8, 0);
+	}
+	imshow("Detected Face", frame);
+}
+
+// the figures printed once a second, from the main loop so they keep coming while
+// detection idles; 'seconds' on the clock detectAndDraw counts in
+void print_report(double seconds)
+{
+	if (seconds - displayTimer <= 1)
+	{
+		return;
+	}
+
+	std::cout << "Current count: " << numberOfFaces << std::endl;
+	if (reid)
+	{
+		std::cout << "Re-identified: " << appearanceCache.hits() << std::endl;
+	}
+	if (worldTracking)
+	{
+		std::cout << "World jumps rejected: " << peopleCounter.world_rejected() << std::endl;
+	}
+	zoneMap.print();
+	if (queueLength)
+	{
+		queueOccupancy.print();
+	}
+	countLines.print(seconds);
+	if (compareDetector)
+	{
+		faceDetectorStats.print(faceDetector->name());
+		compareDetectorStats.print(compareDetector->name());
+	}
+	colourMailbox.print_and_reset();
+	if (depthFilter)
+	{
+		depthFiltering.print_and_reset();
+	}
+	if (idle)
+	{
+		idleScheduler.print_and_reset();
+	}
+	if (recorder)
+	{
+		flightRecorder.print_and_reset();
+		// a burst of people counted at once is worth a look afterwards
+		if (recorderAnomalyCount > 0 && numberOfFaces - recorderLastCount >= recorderAnomalyCount)
+		{
+			flightRecorder.dump("dump: count burst");
+		}
+		recorderLastCount = numberOfFaces;
+	}
+	if (snapshots)
+	{
+		snapshotWriter.print_and_reset();
+	}
+	if (trace)
+	{
+		tracer().print_and_reset();
+	}
+	if (sharedFrames.running())
+	{
+		sharedFrames.print_and_reset();
+	}
+	frameSync.print_and_reset();
+#ifdef COUNT_ALLOCATIONS
+	allocationStats.print_and_reset();
+#endif
+	displayTimer = seconds;
+}
+
+// range, prediction and world matching from the settings, for the live counter and
+// the regression's
+void configure_counter(V2Counter& counter, bool withKalman)
+{
+	WorldReach reach;
+	reach.maxSpeed = worldMaxSpeed;
+	reach.slack = worldSlack;
+	counter.set_range(minDist, maxDist);
+	counter.set_kalman(withKalman, kalmanProcessNoise, kalmanMeasurementNoise, kalmanDepthProcessNoise, kalmanDepthMeasurementNoise, kalmanDepthGate);
+	counter.set_world(worldTracking, reach);
+}
 
-		// does not exist -> look at time
-		if (!faces_verifyingExist[i])
+// everything between the frames and the count that does not need the sensor,
+// for the live pipeline and for replaying recordings alike
+bool setup_pipeline()
+{
+	if (trace)
+	{
+		tracer().start(traceCapacity);
+		tracer().name_thread("main");
+	}
+
+	faceDetector = create_detector(detectorName);
+	if (!faceDetector)
+	{
+		return false;
+	}
+	if (detectorCompare)
+	{
+		compareDetector = create_detector(detectorName == "dnn" ? "cascade" : "dnn");
+	}
+
+	// grey detectors read the sensor buffer directly, the colour frame is only
+	// filled for the windows or a detector that takes colour
+	lumaInput = faceDetector->grey_input() || (compareDetector && compareDetector->grey_input());
+	needColour = !headless || !faceDetector->grey_input() || (compareDetector && !compareDetector->grey_input());
+
+	colourMailbox.set_policy(parse_drop_policy(dropPolicy), processEveryNth);
+
+	// persistent buffers sized up front
+	peopleCounter.reserve(maxFaces);
+	faces_trackingSignature.reserve(maxFaces);
+	faces_trackingZones.reserve(maxFaces);
+	faces_trackingPath.reserve(maxFaces);
+	frameFaces.reserve(maxFaces);
+	configure_counter(peopleCounter, kalman);
+	sharedTracks.reserve(maxFaces * 2);
+	detectionRegions.reserve(DepthBackground::maxRegions);
+	detectionScaled.reserve(DepthBackground::maxRegions);
+	detectionImages.reserve(DepthBackground::maxRegions);
+
+	appearanceCache.configure(reidCapacity, reidTimeout, reidThreshold);
+	load_zones();
+	load_count_lines();
+	idleScheduler.configure(minDist, maxDist, idleCellThreshold, idleMinCells, idleAfter, idleInterval);
+	if (queueLength)
+	{
+		queueOccupancy.configure(cv::Point2f(queueFrom[0], queueFrom[1]), cv::Point2f(queueTo[0], queueTo[1]),
+			queueWidth, queueCell, queueMinY, queueMaxY, queueMinPoints, queueGap);
+	}
+	if (snapshots)
+	{
+		snapshotWriter.start(snapshotWorkers, snapshotQueue, snapshotDir, snapshotFormat);
+	}
+
+	depthFiltering.configure(depthFilterJump, depthFilterSmoothing, depthFilterHold);
+	depthBackground.set_threshold(bgThreshold);
+	depthBackground.set_min_area(bgMinArea);
+	depthBackground.set_step(bgStep);
+	depthBackground.set_absorb(bgAbsorbMinutes * 60);
+
+	frameSync.set_tolerance(syncTolerance);
+	return true;
+}
+
+// settings that take effect while running, from a new version of setting.json
+// the types are checked before anything changes, so a value of the wrong type or values
+// that do not fit together leave every setting as it was. a key that is gone keeps its
+// current value; keys that are only read at start-up are reported, not applied
+bool apply_settings(const json& s)
+{
+	static const char* numbers[] = { "minDist", "maxDist", "timer", "Xdepth", "Ydepth",
+		"depthFilterJump", "depthFilterSmoothing", "depthFilterHold",
+		"bgThreshold", "bgMinArea", "bgPadding", "bgStep", "bgAbsorbMinutes",
+		"dnnConfidence", "faceWidth", "colourFov", "detectionMinFace", "lumaScale", "processEveryNth", "syncTolerance", "reidTimeout", "reidThreshold",
+		"kalmanProcessNoise", "kalmanMeasurementNoise", "kalmanDepthProcessNoise", "kalmanDepthMeasurementNoise", "kalmanDepthGate",
+		"worldMaxSpeed", "worldSlack", "idleAfter", "idleInterval", "idleCellThreshold", "idleMinCells", "idleSleep",
+		"recorderAnomalyCount" };
+	static const char* flags[] = { "depthFilter", "backgroundModel", "detectorCompare", "detectionScaling", "detectionRefine", "reid", "kalman", "worldTracking", "idle", "reloadSettings" };
+	static const char* strings[] = { "detector", "dropPolicy" };
+
+	// in the file and different from the settings applied last
+	auto changed = [&s](std::initializer_list<const char*> keys)
+	{
+		for (const char* key : keys)
 		{
-			// last seen more than 0.5s ago and start verifying more than 2s ago -> delete
-			if (difftime(timer, mktime(&y2k)) - faces_verifyingStartTime.at(i) > 2 &&
-				difftime(timer, mktime(&y2k)) - faces_verifyingLastSeen.at(i) > 0.5)
+			const auto it = s.find(key);
+			const auto last = appliedSettings.find(key);
+			if (it != s.end() && (last == appliedSettings.end() || *it != *last))
 			{
-				faces_IndexDel.push_back(i);
+				return true;
 			}
 		}
+		return false;
+	};
+
+	std::string restart;
+	for (auto it = s.begin(); it != s.end(); ++it)
+	{
+		const std::string key = it.key();
+		int kind = 0;
+		for (const char* name : numbers)
+			kind = key == name ? 1 : kind;
+		for (const char* name : flags)
+			kind = key == name ? 2 : kind;
+		for (const char* name : strings)
+			kind = key == name ? 3 : kind;
+
+		if ((kind == 1 && !it->is_number()) || (kind == 2 && !it->is_boolean()) || (kind == 3 && !it->is_string()))
+		{
+			std::cout << "Settings: " << key << " has the wrong type, keeping the current settings" << std::endl;
+			return false;
+		}
+		if (kind == 0 && changed({ key.c_str() }))
+		{
+			restart += (restart.empty() ? "" : ", ") + key;
+		}
+	}
+
+	const int newMinDist = s.value("minDist", minDist);
+	const int newMaxDist = s.value("maxDist", maxDist);
+	const int newLumaScale = s.value("lumaScale", lumaScale);
+	const int newSmoothing = s.value("depthFilterSmoothing", depthFilterSmoothing);
+	const std::string newDetector = s.value("detector", detectorName);
+	if (newMinDist >= newMaxDist || (newLumaScale != 1 && newLumaScale != 2 && newLumaScale != 4) ||
+		newSmoothing < 0 || newSmoothing > 8 || (newDetector != "cascade" && newDetector != "dnn"))
+	{
+		std::cout << "Settings: minDist, maxDist, lumaScale, depthFilterSmoothing or detector out of range, keeping the current settings" << std::endl;
+		return false;
+	}
+
+	// a different detector is loaded before the old one is let go
+	const float newConfidence = s.value("dnnConfidence", dnnConfidence);
+	const bool newCompare = s.value("detectorCompare", detectorCompare);
+	if (newDetector != detectorName || newConfidence != dnnConfidence || newCompare != detectorCompare)
+	{
+		const float oldConfidence = dnnConfidence;
+		dnnConfidence = newConfidence;
+		std::unique_ptr<FaceDetector> detector = create_detector(newDetector);
+		std::unique_ptr<FaceDetector> compare = newCompare ? create_detector(newDetector == "dnn" ? "cascade" : "dnn") : nullptr;
+		if (!detector || (newCompare && !compare))
+		{
+			dnnConfidence = oldConfidence;
+			std::cout << "Settings: the detector did not load, keeping the current settings" << std::endl;
+			return false;
+		}
+		faceDetector = std::move(detector);
+		compareDetector = std::move(compare);
+		detectorName = newDetector;
+		detectorCompare = newCompare;
+		lumaInput = faceDetector->grey_input() || (compareDetector && compareDetector->grey_input());
+		needColour = !headless || !faceDetector->grey_input() || (compareDetector && !compareDetector->grey_input());
+	}
+
+	minDist = newMinDist;
+	maxDist = newMaxDist;
+	timerTrigger = s.value("timer", timerTrigger);
+	Xdepth = s.value("Xdepth", Xdepth);
+	Ydepth = s.value("Ydepth", Ydepth);
+	windowXSize = Xdepth * 2;
+	windowYSize = Ydepth * 2;
+	depthFilter = s.value("depthFilter", depthFilter);
+	depthFilterJump = s.value("depthFilterJump", depthFilterJump);
+	depthFilterSmoothing = newSmoothing;
+	depthFilterHold = s.value("depthFilterHold", depthFilterHold);
+	backgroundModel = s.value("backgroundModel", backgroundModel);
+	bgThreshold = s.value("bgThreshold", bgThreshold);
+	bgMinArea = s.value("bgMinArea", bgMinArea);
+	bgPadding = s.value("bgPadding", bgPadding);
+	bgStep = s.value("bgStep", bgStep);
+	bgAbsorbMinutes = s.value("bgAbsorbMinutes", bgAbsorbMinutes);
+	detectionScaling = s.value("detectionScaling", detectionScaling);
+	faceWidth = s.value("faceWidth", faceWidth);
+	colourFov = s.value("colourFov", colourFov);
+	detectionMinFace = s.value("detectionMinFace", detectionMinFace);
+	detectionRefine = s.value("detectionRefine", detectionRefine);
+	lumaScale = newLumaScale;
+	dropPolicy = s.value("dropPolicy", dropPolicy);
+	processEveryNth = s.value("processEveryNth", processEveryNth);
+	syncTolerance = s.value("syncTolerance", syncTolerance);
+	reid = s.value("reid", reid);
+	reidTimeout = s.value("reidTimeout", reidTimeout);
+	reidThreshold = s.value("reidThreshold", reidThreshold);
+	kalman = s.value("kalman", kalman);
+	kalmanProcessNoise = s.value("kalmanProcessNoise", kalmanProcessNoise);
+	kalmanMeasurementNoise = s.value("kalmanMeasurementNoise", kalmanMeasurementNoise);
+	kalmanDepthProcessNoise = s.value("kalmanDepthProcessNoise", kalmanDepthProcessNoise);
+	kalmanDepthMeasurementNoise = s.value("kalmanDepthMeasurementNoise", kalmanDepthMeasurementNoise);
+	kalmanDepthGate = s.value("kalmanDepthGate", kalmanDepthGate);
+	worldTracking = s.value("worldTracking", worldTracking);
+	worldMaxSpeed = s.value("worldMaxSpeed", worldMaxSpeed);
+	worldSlack = s.value("worldSlack", worldSlack);
+	idle = s.value("idle", idle);
+	idleAfter = s.value("idleAfter", idleAfter);
+	idleInterval = s.value("idleInterval", idleInterval);
+	idleCellThreshold = s.value("idleCellThreshold", idleCellThreshold);
+	idleMinCells = s.value("idleMinCells", idleMinCells);
+	idleSleep = s.value("idleSleep", idleSleep);
+	recorderAnomalyCount = s.value("recorderAnomalyCount", recorderAnomalyCount);
+	reloadSettings = s.value("reloadSettings", reloadSettings);
+
+	// the modules keep their state, only the parameters that changed are set again;
+	// buffers that depend on a size (luma frame, pyramid, depth filter, background)
+	// follow the next frame
+	if (changed({ "depthFilterJump", "depthFilterSmoothing", "depthFilterHold" }))
+	{
+		depthFiltering.configure(depthFilterJump, depthFilterSmoothing, depthFilterHold);
+	}
+	if (changed({ "bgThreshold", "bgMinArea", "bgStep", "bgAbsorbMinutes" }))
+	{
+		depthBackground.set_threshold(bgThreshold);
+		depthBackground.set_min_area(bgMinArea);
+		depthBackground.set_step(bgStep);
+		depthBackground.set_absorb(bgAbsorbMinutes * 60);
+	}
+	if (changed({ "dropPolicy", "processEveryNth" }))
+	{
+		colourMailbox.set_policy(parse_drop_policy(dropPolicy), processEveryNth);
+	}
+	if (changed({ "syncTolerance" }))
+	{
+		frameSync.set_tolerance(syncTolerance);
+	}
+	if (changed({ "reidTimeout", "reidThreshold" }))
+	{
+		appearanceCache.set_limits(reidTimeout, reidThreshold);
+	}
+	if (changed({ "minDist", "maxDist", "kalman", "kalmanProcessNoise", "kalmanMeasurementNoise", "kalmanDepthProcessNoise",
+		"kalmanDepthMeasurementNoise", "kalmanDepthGate", "worldTracking", "worldMaxSpeed", "worldSlack" }))
+	{
+		configure_counter(peopleCounter, kalman);
+	}
+	if (changed({ "minDist", "maxDist", "idleCellThreshold", "idleMinCells", "idleAfter", "idleInterval" }))
+	{
+		idleScheduler.configure(minDist, maxDist, idleCellThreshold, idleMinCells, idleAfter, idleInterval);
+	}
+	appliedSettings = s;
+
+	std::cout << "Settings: reloaded";
+	if (!restart.empty())
+	{
+		std::cout << ", restart to apply " << restart;
+	}
+	std::cout << std::endl;
+	return true;
+}
+
+// the frame pair and every face being verified or tracked, for other processes
+void publish_frame(const ColourFrame& current, const DepthSlot& depth)
+{
+	sharedTracks.clear();
+	for (int i = 0; i < peopleCounter.verifying().size(); i++)
+	{
+		const cv::Rect& r = peopleCounter.verifying()[i].box;
+		sharedTracks.push_back(SharedTrack{ r.x, r.y, r.width, r.height, face_distance(depth, r), 0, 0.f, 0.f, 0.f });
+	}
+	for (int i = 0; i < peopleCounter.tracking().size(); i++)
+	{
+		const cv::Rect& r = peopleCounter.tracking()[i].box;
+		const WorldPoint& w = peopleCounter.tracking()[i].world;
+		sharedTracks.push_back(SharedTrack{ r.x, r.y, r.width, r.height, face_distance(depth, r), 1, w.x, w.y, w.z });
+	}
+
+	// the colour frame, or the grey one when that is all there is
+	const cv::Mat& image = !current.colour.empty() ? current.colour : current.luma;
+	const bool packed = !image.empty() && image.isContinuous() && image.depth() == CV_8U;
+	sharedFrames.publish(packed ? image.data : nullptr, image.cols, image.rows, image.channels(),
+		depth.depth.data(), depth.width, depth.height,
+		std::chrono::duration_cast<std::chrono::microseconds>(current.captured.time_since_epoch()).count(), current.index,
+		sharedTracks.data(), (int)sharedTracks.size(), numberOfFaces);
+}
+
+// one colour frame and the depth frame paired with it, through background, queue,
+// recorder and - unless idling - detection and tracking
+void process_frame(ColourFrame& current, const DepthSlot& depth)
+{
+	// converted before a reload changed lumaScale, so at the wrong size, or before it
+	// swapped the detector, so without the image the new one takes
+	if ((lumaInput && (current.luma.empty() || current.lumaScale != lumaScale)) ||
+		(needColour && current.colour.empty()))
+	{
+		return;
+	}
+
+	tracer().set_frame(current.index);
+	TraceSpan span("frame");
+
+	if (backgroundModel)
+	{
+		TraceSpan background("background");
+		depthBackground.init(depth.width, depth.height);
+		depthBackground.update(depth.depth.data(), std::chrono::duration<double>(depth.captured.time_since_epoch()).count());
+	}
+	if (queueLength)
+	{
+		TraceSpan queue("queue");
+		queueOccupancy.update(depth.points);
+	}
+
+	if (recorder)
+	{
+		flightRecorder.offer(!current.colour.empty() ? current.colour : current.luma, depth, current.index, current.captured);
+	}
+
+	// while idle only the odd frame is looked at, until the depth frame shows motion;
+	// never while someone is verified or tracked, a missed detection would lose them
+	const double captured = std::chrono::duration<double>(current.captured.time_since_epoch()).count();
+	const bool busy = !peopleCounter.verifying().empty() || !peopleCounter.tracking().empty();
+	const bool detect = !idle || idleScheduler.update(depth, captured, busy);
+	if (detect)
+	{
+		detectAndDraw(current.colour, current.luma, depth, current.captured);
+		if (idleScheduler.waking())
+		{
+			idleScheduler.wake_latency(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - current.captured).count());
+		}
 	}
-	// reverse delete to not mess up indexing before deleting
-	std::reverse(faces_IndexDel.begin(), faces_IndexDel.end());
-	for (int i = 0; i < faces_IndexDel.size(); i++)
+
+	if (sharedFrames.running())
 	{
-		faces_verifying.erase(faces_verifying.begin() + faces_IndexDel.at(i));
-		faces_verifyingExist.erase(faces_verifyingExist.begin() + faces_IndexDel.at(i));
-		faces_verifyingLastSeen.erase(faces_verifyingLastSeen.begin() + faces_IndexDel.at(i));
-		faces_verifyingStartTime.erase(faces_verifyingStartTime.begin() + faces_IndexDel.at(i));
+		TraceSpan publish("shared memory");
+		publish_frame(current, depth);
 	}
-	// clear deleting
-	faces_IndexDel.clear();
 
+	// rectangles only go onto the frame after the recorder and the shared memory have
+	// taken it as it came from the sensor
+	if (detect && !headless)
+	{
+		show_faces(current.colour);
+	}
+	allocationStats.frame_done(allocation_count());
+}
+
+// a flight recorder dump through the whole pipeline, headless and as fast as it goes;
+// the child side of --batch, reporting to the BatchRunner on stdout
+int run_batch_one(const char* path)
+{
+	headless = true;
+	replaying = true;
+	recorder = false;
+	// the runner keeps one child per core busy: each one single-threaded and free to
+	// run anywhere, or they fight over the same cores (and the one dnnPinCpu names)
+	dnnThreads = 1;
+	dnnPinCpu = -1;
+	cv::setNumThreads(1);
+	if (!setup_pipeline())
+	{
+		return 1;
+	}
+
+	RecordingReader reader;
+	if (!reader.open(path))
+	{
+		std::cout << "Unable to read " << path << std::endl;
+		return 1;
+	}
 
-	// similarly dealing with tracking faces
-	for (int i = 0; i < faces_trackingExist.size(); i++)
+	ColourFrame current;
+	DepthSlot depth;
+	RecordHeader imageHeader, depthHeader;
+	cv::Mat image;
+	cv::Mat grey;
+	long long frames = 0;
+	int64_t first = -1;
+	int64_t last = 0;
+	const auto start = std::chrono::steady_clock::now();
+	while (reader.next_pair(image, imageHeader, depth.depth, depth.width, depth.height, depthHeader))
 	{
-		faces_trackingExist[i] = false;
-		// loop through all faces available
-		for (int j = 0; j < faces.size(); j++)
+		// the frames as the colour listener would have handed them over; the depth
+		// frame was recorded after the depth filter, if that was on
+		const cv::Size size(depth.width * 4, depth.height * 4);
+		if (image.size() != size)
+		{
+			cv::resize(image, image, size);
+		}
+		if (image.channels() == 1)
 		{
-			// detected in boundary -> exist
-			if (!(faces[j].x + faces[j].width < faces_tracking[i].x) &&
-				!(faces[j].x > faces_tracking[i].x + faces_tracking[i].width) &&
-				!(faces[j].y + faces[j].height < faces_tracking[i].y) &&
-				!(faces[j].y > faces_tracking[i].y + faces_tracking[i].height)
-				)
+			grey = image;
+			if (needColour)
 			{
-				faces_trackingExist[i] = true;
-				cv::Scalar color = cv::Scalar(255, 0, 0);
-				rectangle(frame, cvPoint(cvRound(faces_tracking.at(i).x*scale), cvRound(faces_tracking.at(i).y*scale)), cvPoint(cvRound((faces_tracking.at(i).x +
-					faces_tracking.at(i).width - 1)*scale), cvRound((faces_tracking.at(i).y + faces_tracking.at(i).height - 1)*scale)), color, 3, 8, 0);
-				// adjust new values
-				faces_tracking[i] = faces[j];
-				faces_trackingLastSeen[i] = difftime(timer, mktime(&y2k));
+				cv::cvtColor(image, current.colour, cv::COLOR_GRAY2BGR);
 			}
-			break;
 		}
-
-		// does not exist -> look at time
-		if (!faces_trackingExist[i])
+		else
 		{
-			// last seen more than 0.5s ago and start verifying more than 2s ago -> delete
-			if (difftime(timer, mktime(&y2k)) - faces_trackingStartTime.at(i) > 2 &&
-				difftime(timer, mktime(&y2k)) - faces_trackingLastSeen.at(i) > 2)
+			current.colour = image;
+			if (lumaInput)
 			{
-				faces_IndexDel.push_back(i);
+				cv::cvtColor(image, grey, cv::COLOR_BGR2GRAY);
+				cv::equalizeHist(grey, grey);
 			}
 		}
+		if (lumaInput)
+		{
+			cv::resize(grey, current.luma, cv::Size(size.width / lumaScale, size.height / lumaScale));
+			current.lumaScale = lumaScale;
+		}
+		current.index = imageHeader.index;
+		current.captured = std::chrono::steady_clock::time_point(std::chrono::microseconds(imageHeader.time));
+		depth.index = depthHeader.index;
+		depth.captured = std::chrono::steady_clock::time_point(std::chrono::microseconds(depthHeader.time));
+
+		process_frame(current, depth);
+		print_report(std::floor(std::chrono::duration<double>(current.captured.time_since_epoch()).count()));
+
+		if (first < 0)
+		{
+			first = imageHeader.time;
+		}
+		last = imageHeader.time;
+		if (++frames % 100 == 0)
+		{
+			std::cout << "@progress " << frames << " " << reader.position() << std::endl;
+		}
+	}
+
+	// an empty scene a few seconds on, so whoever was still tracked is counted as if they had left
+	if (frames > 0)
+	{
+		current.colour.setTo(cv::Scalar::all(0));
+		current.luma.setTo(cv::Scalar::all(0));
+		std::fill(depth.depth.begin(), depth.depth.end(), 0);
+		current.captured += std::chrono::seconds(3);
+		depth.captured = current.captured;
+		process_frame(current, depth);
+	}
+
+	snapshotWriter.stop();
+	if (trace)
+	{
+		tracer().write(std::string(path) + ".trace.json");
+	}
+	const double processing = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "@result " << frames << " " << (last - first) / 1e6 << " " << numberOfFaces << " " << processing << std::endl;
+	return 0;
+}
+
+// many recordings at once, one process each, with a progress and throughput report
+// main --batch [--jobs <n>] [--out <report.csv>] <recording.rec>...
+int run_batch(const char* program, int count, char** args)
+{
+	int jobs = (int)std::thread::hardware_concurrency();
+	std::string out = "batch.csv";
+	std::vector<std::string> recordings;
+	for (int i = 0; i < count; i++)
+	{
+		const std::string arg = args[i];
+		if (arg == "--jobs" && i + 1 < count)
+		{
+			jobs = std::atoi(args[++i]);
+		}
+		else if (arg == "--out" && i + 1 < count)
+		{
+			out = args[++i];
+		}
+		else
+		{
+			recordings.push_back(arg);
+		}
 	}
-	// reverse delete to not mess up indexing before deleting
-	std::reverse(faces_IndexDel.begin(), faces_IndexDel.end());
-	for (int i = 0; i < faces_IndexDel.size(); i++)
+	if (recordings.empty())
 	{
-		faces_tracking.erase(faces_tracking.begin() + faces_IndexDel.at(i));
-		faces_trackingExist.erase(faces_trackingExist.begin() + faces_IndexDel.at(i));
-		faces_trackingLastSeen.erase(faces_trackingLastSeen.begin() + faces_IndexDel.at(i));
-		faces_trackingStartTime.erase(faces_trackingStartTime.begin() + faces_IndexDel.at(i));
-		numberOfFaces++;
+		std::cout << "No recordings given" << std::endl;
+		return 1;
 	}
-	// clear deleting
-	faces_IndexDel.clear();
 
-	// -------------------------------------
+	BatchRunner runner(program, recordings);
+	runner.run(jobs > 0 ? jobs : 1);
+	return runner.write_report(out) ? 0 : 1;
+}
 
+// running both detectors over recorded videos, frame by frame
+int compare_recordings(int count, char** files)
+{
+	faceDetector = create_detector("cascade");
+	compareDetector = create_detector("dnn");
+	if (!faceDetector || !compareDetector)
+		return 1;
 
-	// goes through all faces detected
-	for (int i = 0; i < faces.size(); i++)
+	for (int f = 0; f < count; f++)
 	{
-		bool faceExist = false;
+		cv::VideoCapture capture(files[f]);
+		if (!capture.isOpened())
+		{
+			std::cout << "Unable to open " << files[f] << std::endl;
+			continue;
+		}
 
-		// isit being verify?
-		for (int j = 0; j < faces_verifying.size(); j++)
+		DetectorStats cascadeStats;
+		DetectorStats dnnStats;
+		cv::Mat frame;
+		while (capture.read(frame))
 		{
-			// make sure all has to be detected again
-			// if detected
-			if (!(faces[i].x + faces[i].width < faces_verifying[j].x) &&
-				!(faces[i].x > faces_verifying[j].x + faces_verifying[j].width) &&
-				!(faces[i].y + faces[i].height < faces_verifying[j].y) &&
-				!(faces[i].y > faces_verifying[j].y + faces_verifying[j].height)
-				)
-			{
-				faceExist = true;
-				break;
-			}
+			framePyramid.reset(frame);
+			detectionRegions.assign(1, cv::Rect(0, 0, frame.cols, frame.rows));
+
+			frameArena.reset();
+			FaceList cascadeFaces(frameArena);
+			FaceList dnnFaces(frameArena);
+			run_detector(*faceDetector, framePyramid, detectionResults, cascadeFaces, cascadeStats);
+			run_detector(*compareDetector, framePyramid, compareResults, dnnFaces, dnnStats);
+
+			cascadeStats.faces += cascadeFaces.size();
+			cascadeStats.matched += count_matched(cascadeFaces, dnnFaces);
+			dnnStats.faces += dnnFaces.size();
+			dnnStats.matched += count_matched(dnnFaces, cascadeFaces);
 		}
 
+		std::cout << files[f] << std::endl;
+		cascadeStats.print(faceDetector->name());
+		dnnStats.print(compareDetector->name());
+	}
+	return 0;
+}
+
+// v1 and v2 counting side by side over annotated sequences, synthetic ones and recordings
+int run_regression(int count, char** inputs)
+{
+	// detection for recordings, as in the live pipeline
+	auto detect = [](const cv::Mat& image, std::vector<cv::Rect>& found)
+	{
+		framePyramid.reset(image);
+		detectionRegions.assign(1, cv::Rect(0, 0, image.cols, image.rows));
+		frameArena.reset();
+		FaceList faces(frameArena);
+		run_detector(*faceDetector, framePyramid, detectionResults, faces, faceDetectorStats);
+		found.assign(faces.begin(), faces.end());
+	};
+
+	const char* synthetic = "synthetic:20";
+	if (count == 0)
+	{
+		inputs = const_cast<char**>(&synthetic);
+		count = 1;
+	}
 
-		// isit being tracked?
-		for (int j = 0; j < faces_tracking.size(); j++)
+	for (int f = 0; f < count; f++)
+	{
+		const std::string input = inputs[f];
+		Sequence sequence;
+		double detectSeconds = 0;
+		if (input.compare(0, 10, "synthetic:") == 0)
 		{
-			if (!(faces[i].x + faces[i].width < faces_tracking[j].x) &&
-				!(faces[i].x > faces_tracking[j].x + faces_tracking[j].width) &&
-				!(faces[i].y + faces[i].height < faces_tracking[j].y) &&
-				!(faces[i].y > faces_tracking[j].y + faces_tracking[j].height)
-				)
+			// synthetic:<people>[:<seed>]
+			int people = 20;
+			unsigned seed = 1;
+			sscanf(input.c_str(), "synthetic:%d:%u", &people, &seed);
+			sequence = synthetic_sequence(people, seed, minDist, maxDist);
+		}
+		else if (input.size() > 4 && input.compare(input.size() - 4, 4, ".rec") == 0)
+		{
+			if (!faceDetector)
+				faceDetector = create_detector(detectorName);
+			if (!faceDetector || !load_recording(input, sequence, detect, detectSeconds))
 			{
-				faceExist = true;
-				break;
+				std::cout << "Unable to read " << input << std::endl;
+				continue;
 			}
 		}
+		else if (!load_sequence(input, sequence))
+		{
+			std::cout << "Unable to read " << input << std::endl;
+			continue;
+		}
 
-
-		// add to verify if new face
-		if (!faceExist)
+		std::cout << sequence.name << ": " << sequence.frames.size() << " frames";
+		if (detectSeconds > 0)
+			std::cout << ", detection " << sequence.frames.size() / detectSeconds << " fps";
+		std::cout << std::endl;
+
+		V1Counter v1(minDist, maxDist, timerTrigger);
+		V2Counter v2;
+		configure_counter(v2, false);
+		V2Counter v2Kalman;
+		configure_counter(v2Kalman, true);
+		Counter* counters[] = { &v1, &v2, &v2Kalman };
+		for (int c = 0; c < 3; c++)
 		{
-			cv::Scalar color = cv::Scalar(0, 255, 0);
-			rectangle(frame, cvPoint(cvRound(faces.at(i).x*scale), cvRound(faces.at(i).y*scale)), cvPoint(cvRound((faces.at(i).x +
-				faces.at(i).width - 1)*scale), cvRound((faces.at(i).y + faces.at(i).height - 1)*scale)), color, 3, 8, 0);
-			// must be within distance minDist and maxDist 
-			if (distanceValue[(faces.at(i).x + faces.at(i).width / 2) / 4][(faces.at(i).y + faces.at(i).height / 2) / 4] > minDist &&
-				distanceValue[(faces.at(i).x + faces.at(i).width / 2) / 4][(faces.at(i).y + faces.at(i).height / 2) / 4] < maxDist)
-			{
-				// divide by 4 since depth 	
-				faces_verifying.push_back(faces[i]); // the roi
-				faces_verifyingExist.push_back(true); // existence
-				faces_verifyingStartTime.push_back(difftime(timer, mktime(&y2k))); // start time
-				faces_verifyingLastSeen.push_back(difftime(timer, mktime(&y2k))); // last seen
-			}
+			print_result(counters[c]->name(), sequence, run_counter(*counters[c], sequence));
 		}
 	}
-
-	imshow("Detected Face", frame);
+	return 0;
 }
 
 int main(int argc, char** argv)
 {
+	// main --compare-detectors <video>... -> detector report only, no sensor needed
+	if (argc > 1 && std::string(argv[1]) == "--compare-detectors")
+	{
+		return compare_recordings(argc - 2, argv + 2);
+	}
+	// main --batch [--jobs <n>] [--out <report.csv>] <recording.rec>... -> per-session counts
+	if (argc > 1 && std::string(argv[1]) == "--batch")
+	{
+		return run_batch(argv[0], argc - 2, argv + 2);
+	}
+	if (argc > 2 && std::string(argv[1]) == "--batch-one")
+	{
+		return run_batch_one(argv[2]);
+	}
+	// main --regression [<sequence.seq>|<recording.rec>|synthetic:<people>[:<seed>]]... -> counting report
+	if (argc > 1 && std::string(argv[1]) == "--regression")
+	{
+		return run_regression(argc - 2, argv + 2);
+	}
+	// main --benchmark-kernels [<repeats>] -> ns per frame of every pixel loop in every sensor mode
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-kernels")
+	{
+		benchmark_frame_kernels(argc > 2 ? std::atoi(argv[2]) : 1000);
+		return 0;
+	}
+
+	if (!setup_pipeline())
+	{
+		return 1;
+	}
+
 	astra::initialize();
 
 	set_key_handler();
 
 
 	// -------------- colour viewer
-	sf::RenderWindow windowColour(sf::VideoMode(windowXSize, windowYSize), "Color Viewer");
+	std::unique_ptr<sf::RenderWindow> windowColour;
+	if (!headless)
+	{
+		windowColour.reset(new sf::RenderWindow(sf::VideoMode(windowXSize, windowYSize), "Color Viewer"));
+	}
 
 	astra::StreamSet streamSetColour;
 	astra::StreamReader readerColour = streamSetColour.create_reader();
@@ -577,7 +1737,11 @@ int main(int argc, char** argv)
 
 
 	// ------------ depth viewer
-	sf::RenderWindow windowDepth(sf::VideoMode(windowXSize, windowYSize), "Depth Viewer");
+	std::unique_ptr<sf::RenderWindow> windowDepth;
+	if (!headless)
+	{
+		windowDepth.reset(new sf::RenderWindow(sf::VideoMode(windowXSize, windowYSize), "Depth Viewer"));
+	}
 
 #ifdef _WIN32
 	auto fullscreenStyle = sf::Style::None;
@@ -600,60 +1764,171 @@ int main(int argc, char** argv)
 
 	readerDepth.add_listener(listenerDepth);
 
-	while (windowColour.isOpen())
+#ifndef _WIN32
+	if (trace)
 	{
-		astra_update();
+		std::signal(SIGUSR2, on_trace_signal);
+	}
+#endif
+	if (sharedMemory)
+	{
+		// room for depth frames up to half the colour size, for the 320x240 depth mode
+		sharedFrames.start(sharedMemoryName, sharedMemorySlots, sharedMemoryWidth, sharedMemoryHeight,
+			sharedMemoryWidth / 2, sharedMemoryHeight / 2, maxFaces * 2);
+	}
+	ConfigWatcher configWatcher;
+	if (reloadSettings)
+	{
+		configWatcher.start("setting.json");
+	}
+	if (recorder)
+	{
+		flightRecorder.start((size_t)recorderMemory << 20, recorderSeconds, recorderQuality, recorderDir);
+#ifdef _WIN32
+		std::signal(SIGBREAK, on_recorder_signal);
+#else
+		std::signal(SIGUSR1, on_recorder_signal);
+#endif
+	}
 
-		sf::Event event;
-		while (windowColour.pollEvent(event))
+	ColourFrame* current = nullptr;
+
+	// the report runs on the same seconds since 2000 as detectAndDraw
+	struct tm y2k = { 0 };
+	y2k.tm_hour = 0;   y2k.tm_min = 0; y2k.tm_sec = 0;
+	y2k.tm_year = 100; y2k.tm_mon = 0; y2k.tm_mday = 1;
+	const time_t y2kTime = mktime(&y2k);
+
+	// the loop spins far more often than frames arrive; its sensor update and window
+	// render are only recorded for the passes that processed a frame
+	PendingSpan sensorUpdate("sensor update");
+	PendingSpan windowRender("window render");
+
+	bool running = true;
+	while (running)
+	{
+		// a new version of the settings, between two frames
+		ConfigWatcher::Snapshot settings = configWatcher.take();
+		if (settings && apply_settings(*settings) && !headless)
 		{
-			switch (event.type)
-			{
-			case sf::Event::Closed:
-				windowColour.close();
-				windowDepth.close();
+			windowColour->setSize(sf::Vector2u(windowXSize, windowYSize));
+			windowDepth->setSize(sf::Vector2u(windowXSize, windowYSize));
+		}
+
+		sensorUpdate.begin();
+		astra_update();
+		sensorUpdate.end();
 
-				break;
-			case sf::Event::KeyPressed:
+		if (!headless)
+		{
+			sf::Event event;
+			while (windowColour->pollEvent(event))
 			{
-				if (event.key.code == sf::Keyboard::Escape ||
-					(event.key.code == sf::Keyboard::C && event.key.control))
+				switch (event.type)
 				{
-					windowColour.close();
-					windowDepth.close();
+				case sf::Event::Closed:
+					windowColour->close();
+					windowDepth->close();
 
+					break;
+				case sf::Event::KeyPressed:
+				{
+					if (event.key.code == sf::Keyboard::Escape ||
+						(event.key.code == sf::Keyboard::C && event.key.control))
+					{
+						windowColour->close();
+						windowDepth->close();
+
+					}
+					else if (event.key.code == sf::Keyboard::D)
+					{
+						flightRecorder.dump("dump: key");
+					}
+					else if (event.key.code == sf::Keyboard::T)
+					{
+						traceSignal = 1;
+					}
+				}
+				default:
+					break;
 				}
 			}
-			default:
-				break;
-			}
-		}
-
 
+			// clear the window with black color
+			windowRender.begin();
+			windowColour->clear(sf::Color::Black);
+			windowDepth->clear(sf::Color::Black);
 
+			listenerColour.drawTo(*windowColour);
+			listenerDepth.draw_to(*windowDepth);
 
-		// clear the window with black color
-		windowColour.clear(sf::Color::Black);
-		windowDepth.clear(sf::Color::Black);
+			windowColour->display();
+			windowDepth->display();
+			windowRender.end();
+		}
 
-		listenerColour.drawTo(windowColour);
-		listenerDepth.draw_to(windowDepth);
+		if (!shouldContinue)
+		{
+			running = false;
+		}
 
-		windowColour.display();
-		windowDepth.display();
+		if (recorderSignal)
+		{
+			recorderSignal = 0;
+			flightRecorder.dump("dump: signal");
+		}
+		if (traceSignal)
+		{
+			traceSignal = 0;
+			if (trace)
+			{
+				tracer().write(traceFile);
+			}
+		}
 
-		auto coordinateMapper = depthStream.coordinateMapper();
-		listenerDepth.update_depth(windowDepth, coordinateMapper);
+		print_report(difftime(time(NULL), y2kTime));
 
+		// only a frame that has not been processed yet, and only the newest one;
+		// it waits here until the depth frame taken at the same time has arrived
+		if (current == nullptr)
+		{
+			current = colourMailbox.take();
+		}
+		if (current != nullptr)
+		{
+			const DepthSlot* depth = nullptr;
+			const SyncResult sync = frameSync.match(current->captured, depth);
+			if (sync == SyncResult::Matched)
+			{
+				process_frame(*current, *depth);
+				sensorUpdate.record(current->index);
+				windowRender.record(current->index);
+			}
+			if (sync != SyncResult::Wait)
+			{
+				current = nullptr;
+			}
+		}
 
-		if (!shouldContinue)
+		if (!headless && !windowColour->isOpen())
 		{
-			windowColour.close();
+			running = false;
+		}
 
+		// nothing to hurry for
+		if (idle && idleScheduler.idle())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(idleSleep));
 		}
-		detectAndDraw(DisplayImage);
 	}
 
+	configWatcher.stop();
+	snapshotWriter.stop();
+	flightRecorder.stop();
+	if (trace)
+	{
+		tracer().write(traceFile);
+	}
 	astra::terminate();
 	return 0;
 }